@@ -1,22 +1,29 @@
 set(LINK_SOURCE_FILES
     "${PROJECT_SRC_DIR}/link/mqtt.cpp"
     "${PROJECT_SRC_DIR}/link/influx.cpp"
+    "${PROJECT_SRC_DIR}/link/spool.cpp"
+    "${PROJECT_SRC_DIR}/link/sharded_mqtt.cpp"
     )
 set(LINK_HEADER_FILES
     "${PROJECT_HEADER_DIR}/muonpi/link/mqtt.h"
     "${PROJECT_HEADER_DIR}/muonpi/link/influx.h"
+    "${PROJECT_HEADER_DIR}/muonpi/link/topic_trie.h"
+    "${PROJECT_HEADER_DIR}/muonpi/link/spool.h"
+    "${PROJECT_HEADER_DIR}/muonpi/link/sharded_mqtt.h"
     )
 
 set(HTTP_SOURCE_FILES
     "${PROJECT_SRC_DIR}/http_server.cpp"
     "${PROJECT_SRC_DIR}/http_request.cpp"
     "${PROJECT_SRC_DIR}/http_tools.cpp"
+    "${PROJECT_SRC_DIR}/http_cache.cpp"
 
     )
 set(HTTP_HEADER_FILES
     "${PROJECT_HEADER_DIR}/muonpi/http_server.h"
     "${PROJECT_HEADER_DIR}/muonpi/http_request.h"
     "${PROJECT_HEADER_DIR}/muonpi/http_tools.h"
+    "${PROJECT_HEADER_DIR}/muonpi/http_cache.h"
 
     "${PROJECT_DETAIL_DIR}/http_session.hpp"
     )
@@ -29,6 +36,11 @@ set(CORE_SOURCE_FILES
     "${PROJECT_SRC_DIR}/utility.cpp"
     "${PROJECT_SRC_DIR}/scopeguard.cpp"
     "${PROJECT_SRC_DIR}/exceptions.cpp"
+    "${PROJECT_SRC_DIR}/notifier.cpp"
+    "${PROJECT_SRC_DIR}/executor.cpp"
+    "${PROJECT_SRC_DIR}/placement.cpp"
+    "${PROJECT_SRC_DIR}/metrics.cpp"
+    "${PROJECT_SRC_DIR}/codec.cpp"
     "${PROJECT_SRC_DIR}/supervision/resource.cpp"
     )
 
@@ -36,7 +48,16 @@ set(CORE_HEADER_FILES
     "${PROJECT_HEADER_DIR}/muonpi/sink/base.h"
     "${PROJECT_HEADER_DIR}/muonpi/source/base.h"
     "${PROJECT_HEADER_DIR}/muonpi/pipeline/base.h"
+    "${PROJECT_HEADER_DIR}/muonpi/pipeline/transform.h"
     "${PROJECT_HEADER_DIR}/muonpi/threadrunner.h"
+    "${PROJECT_HEADER_DIR}/muonpi/notifier.h"
+    "${PROJECT_HEADER_DIR}/muonpi/executor.h"
+    "${PROJECT_HEADER_DIR}/muonpi/placement.h"
+    "${PROJECT_HEADER_DIR}/muonpi/metrics.h"
+    "${PROJECT_HEADER_DIR}/muonpi/lockfree_queue.h"
+    "${PROJECT_HEADER_DIR}/muonpi/span.h"
+    "${PROJECT_HEADER_DIR}/muonpi/types.h"
+    "${PROJECT_HEADER_DIR}/muonpi/codec.h"
     "${PROJECT_HEADER_DIR}/muonpi/log.h"
     "${PROJECT_HEADER_DIR}/muonpi/configuration.h"
     "${PROJECT_HEADER_DIR}/muonpi/utility.h"
@@ -194,7 +194,7 @@ set(CPACK_DEBIAN_LIBMUONPICOREDEV_DESCRIPTION "Libraries for MuonPi
  Core dev package")
 set(CPACK_COMPONENT_LIBMUONPICOREDEV_DESCRIPTION "${CPACK_DEBIAN_LIBMUONPICOREDEV_DESCRIPTION}")
 set(CPACK_DEBIAN_LIBMUONPICOREDEV_PACKAGE_NAME "libmuonpi-core-dev")
-set(CPACK_DEBIAN_LIBMUONPICOREDEV_PACKAGE_DEPENDS "libmuonpi-core (= ${CPACK_PACKAGE_VERSION}), libboost-dev (>= 1.69)")
+set(CPACK_DEBIAN_LIBMUONPICOREDEV_PACKAGE_DEPENDS "libmuonpi-core (= ${CPACK_PACKAGE_VERSION}), libboost-dev (>= 1.70)")
 
 if (LIBMUONPI_BUILD_LINK)
     set(CPACK_DEBIAN_LIBMUONPILINK_DESCRIPTION "Libraries for MuonPi
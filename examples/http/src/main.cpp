@@ -15,8 +15,8 @@ auto main() -> int
     muonpi::http::http_server service{config};
 
     muonpi::http::path_handler handler1 {};
-    handler1.matches = [](std::string_view path) {return path == "hello";};
-    handler1.handle = [](muonpi::http::request_type& req, const std::queue<std::string>& /*unused*/) -> muonpi::http::response_type {
+    handler1.path = "hello";
+    handler1.handle = [](muonpi::http::request_type& req, const muonpi::http::path_view& /*unused*/) -> muonpi::http::response_type {
         std::cout<<"Got request for /hello\n"<<std::flush;
         return muonpi::http::http_response<muonpi::http::http_status::ok>(req)("Hello!");
     };
@@ -24,15 +24,15 @@ auto main() -> int
     service.add_handler(handler1);
 
     muonpi::http::path_handler handler2 {};
-    handler2.matches = [](std::string_view path) {return path == "bye";};
-    handler2.handle = [](muonpi::http::request_type& req, const std::queue<std::string>& /*unused*/) -> muonpi::http::response_type {
+    handler2.path = "bye";
+    handler2.handle = [](muonpi::http::request_type& req, const muonpi::http::path_view& /*unused*/) -> muonpi::http::response_type {
         std::cout<<"Got request for /bye\n"<<std::flush;
         return muonpi::http::http_response<muonpi::http::http_status::ok>(req)("Bye!");
     };
 
     muonpi::http::path_handler handler3 {};
-    handler3.matches = [](std::string_view path) {return path == "bye";};
-    handler3.handle = [](muonpi::http::request_type& req, const std::queue<std::string>& /*unused*/) -> muonpi::http::response_type {
+    handler3.path = "bye";
+    handler3.handle = [](muonpi::http::request_type& req, const muonpi::http::path_view& /*unused*/) -> muonpi::http::response_type {
         std::cout<<"Got request for /bye/bye\n"<<std::flush;
         return muonpi::http::http_response<muonpi::http::http_status::ok>(req)("Bye-Bye!");
     };
@@ -41,5 +41,14 @@ auto main() -> int
 
     service.add_handler(handler2);
 
+    muonpi::http::path_handler handler4 {};
+    handler4.path = "station/{id}";
+    handler4.handle = [](muonpi::http::request_type& req, const muonpi::http::path_view& path) -> muonpi::http::response_type {
+        std::cout<<"Got request for station "<<path.parameter("id")<<'\n'<<std::flush;
+        return muonpi::http::http_response<muonpi::http::http_status::ok>(req)("Station " + std::string{path.parameter("id")});
+    };
+
+    service.add_handler(handler4);
+
     service.join();
 }
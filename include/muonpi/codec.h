@@ -0,0 +1,302 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "muonpi/global.h"
+
+#include "muonpi/types.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace muonpi::error {
+
+class LIBMUONPI_PUBLIC codec_error : public std::runtime_error {
+public:
+    explicit codec_error(const std::string& reason)
+        : std::runtime_error { "Could not decode binary message: " + reason }
+    {
+    }
+};
+
+}
+
+/**
+ * @brief The binary message codec.
+ * A frame consists of a header followed by any number of records of one type.
+ * The header holds a magic number, the version of the frame format, the encoding of the records,
+ * the id and version of the schema of the records and the number of records.
+ * Each record is the concatenation of the fields listed in the schema of its type, in the order given there,
+ * so the layout does not depend on the padding of the struct.
+ * With Encoding::Varint, integral and enum fields are stored as LEB128 varints, signed ones zigzag encoded first.
+ * Other fields are always stored with their object representation.
+ */
+namespace muonpi::codec {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The binary codec stores values in native byte order, which has to be little endian.");
+
+enum class Encoding : std::uint8_t {
+    Fixed = 0,
+    Varint = 1
+};
+
+/**
+ * @brief The schema struct. Describes the binary layout of a type. Has to be specialised for every encoded type.
+ * All fields have to be trivially copyable, and there has to be at least one.
+ *
+ * @code
+ * template <>
+ * struct muonpi::codec::schema<event_t> {
+ *     static constexpr std::uint16_t id { 1 };
+ *     static constexpr std::uint16_t version { 1 };
+ *     static constexpr auto fields { std::make_tuple(&event_t::start, &event_t::duration, &event_t::station) };
+ * };
+ * @endcode
+ */
+template <typename T>
+struct schema;
+
+/**
+ * @brief The header_t struct. The description of a frame.
+ */
+struct LIBMUONPI_PUBLIC header_t {
+    std::uint16_t schema { 0 };
+    std::uint16_t version { 0 };
+    Encoding encoding { Encoding::Fixed };
+    std::uint64_t count { 0 };
+};
+
+/**
+ * @brief peek Reads the header of a frame without decoding the records.
+ * Useful to find the type of a frame when one topic carries several.
+ * @throws error::codec_error if the frame is malformed
+ */
+[[nodiscard]] LIBMUONPI_PUBLIC auto peek(std::string_view frame) -> header_t;
+
+/**
+ * @brief encode Encodes a single value into a frame
+ * @param value The value to encode
+ * @param encoding The encoding of the fields
+ */
+template <typename T>
+[[nodiscard]] auto encode(const T& value, Encoding encoding = Encoding::Fixed) -> std::string;
+
+/**
+ * @brief encode Encodes a number of values into a single frame
+ * @param values The values to encode
+ * @param encoding The encoding of the fields
+ */
+template <typename T>
+[[nodiscard]] auto encode(const std::vector<T>& values, Encoding encoding = Encoding::Fixed) -> std::string;
+
+/**
+ * @brief decode Decodes the records of a frame one by one, without collecting them
+ * @param frame The frame to decode
+ * @param function Gets called with each decoded record
+ * @return The number of decoded records
+ * @throws error::codec_error if the frame is malformed, has bytes left after the last record,
+ * or does not contain records of type T in the current schema version
+ */
+template <typename T, typename F>
+auto decode(std::string_view frame, F&& function) -> std::size_t;
+
+/**
+ * @brief decode Decodes all records of a frame
+ * @param frame The frame to decode
+ * @throws error::codec_error if the frame is malformed, has bytes left after the last record,
+ * or does not contain records of type T in the current schema version
+ */
+template <typename T>
+[[nodiscard]] auto decode(std::string_view frame) -> std::vector<T>;
+
+namespace detail {
+    void LIBMUONPI_PUBLIC write_varint(std::uint64_t value, std::string& bytes);
+
+    [[nodiscard]] LIBMUONPI_PUBLIC auto read_varint(std::string_view& bytes) -> std::uint64_t;
+
+    void LIBMUONPI_PUBLIC write_header(const header_t& header, std::string& bytes);
+
+    [[nodiscard]] LIBMUONPI_PUBLIC auto read_header(std::string_view& bytes) -> header_t;
+
+    /**
+     * @brief take Removes a number of bytes from the front of a byte string
+     * @throws error::codec_error if there are not enough bytes
+     */
+    [[nodiscard]] LIBMUONPI_PUBLIC auto take(std::string_view& bytes, std::size_t count) -> std::string_view;
+
+    template <typename V>
+    constexpr bool s_varint { (std::is_integral_v<V> || std::is_enum_v<V>) && (sizeof(V) > 1) };
+
+    template <typename V>
+    void write_field(const V& value, Encoding encoding, std::string& bytes);
+
+    template <typename V>
+    void read_field(V& value, Encoding encoding, std::string_view& bytes);
+
+    template <typename T>
+    void write_record(const T& value, Encoding encoding, std::string& bytes);
+
+    template <typename T>
+    [[nodiscard]] auto read_record(Encoding encoding, std::string_view& bytes) -> T;
+
+    /**
+     * @brief record_size The size of a record with Encoding::Fixed
+     */
+    template <typename T>
+    [[nodiscard]] constexpr auto record_size() -> std::size_t;
+
+    /**
+     * @brief min_record_size The smallest size a record can have in an encoding. Varint fields take at least one byte.
+     */
+    template <typename T>
+    [[nodiscard]] constexpr auto min_record_size(Encoding encoding) -> std::size_t;
+}
+
+// +++++++++++++++++++++++++++++++
+// implementation part starts here
+// +++++++++++++++++++++++++++++++
+
+template <typename V>
+void detail::write_field(const V& value, Encoding encoding, std::string& bytes)
+{
+    static_assert(std::is_trivially_copyable_v<V>, "Only trivially copyable fields can be encoded.");
+    if constexpr (s_varint<V>) {
+        if (encoding == Encoding::Varint) {
+            using integral_t = typename std::conditional_t<std::is_enum_v<V>, std::underlying_type<V>, std::enable_if<true, V>>::type;
+            const auto integral { static_cast<integral_t>(value) };
+            if constexpr (std::is_signed_v<integral_t>) {
+                const auto wide { static_cast<std::int64_t>(integral) };
+                write_varint((static_cast<std::uint64_t>(wide) << 1U) ^ static_cast<std::uint64_t>(wide >> 63), bytes);
+            } else {
+                write_varint(static_cast<std::uint64_t>(integral), bytes);
+            }
+            return;
+        }
+    }
+    to_bytes(value, bytes);
+}
+
+template <typename V>
+void detail::read_field(V& value, Encoding encoding, std::string_view& bytes)
+{
+    if constexpr (s_varint<V>) {
+        if (encoding == Encoding::Varint) {
+            using integral_t = typename std::conditional_t<std::is_enum_v<V>, std::underlying_type<V>, std::enable_if<true, V>>::type;
+            const std::uint64_t raw { read_varint(bytes) };
+            if constexpr (std::is_signed_v<integral_t>) {
+                const auto wide { static_cast<std::int64_t>(raw >> 1U) ^ -static_cast<std::int64_t>(raw & 1U) };
+                if ((wide < std::numeric_limits<integral_t>::min()) || (wide > std::numeric_limits<integral_t>::max())) {
+                    throw error::codec_error { "field out of range" };
+                }
+                value = static_cast<V>(static_cast<integral_t>(wide));
+            } else {
+                if (raw > std::numeric_limits<integral_t>::max()) {
+                    throw error::codec_error { "field out of range" };
+                }
+                value = static_cast<V>(static_cast<integral_t>(raw));
+            }
+            return;
+        }
+    }
+    value = from_bytes<V>(take(bytes, sizeof(V)));
+}
+
+template <typename T>
+void detail::write_record(const T& value, Encoding encoding, std::string& bytes)
+{
+    std::apply([&](auto... fields) { (write_field(value.*fields, encoding, bytes), ...); }, schema<T>::fields);
+}
+
+template <typename T>
+auto detail::read_record(Encoding encoding, std::string_view& bytes) -> T
+{
+    T value {};
+    std::apply([&](auto... fields) { (read_field(value.*fields, encoding, bytes), ...); }, schema<T>::fields);
+    return value;
+}
+
+template <typename T>
+constexpr auto detail::record_size() -> std::size_t
+{
+    static_assert(std::tuple_size_v<std::decay_t<decltype(schema<T>::fields)>> > 0, "A schema needs at least one field.");
+    return std::apply([](auto... fields) { return (std::size_t { 0 } + ... + sizeof(std::declval<T&>().*fields)); }, schema<T>::fields);
+}
+
+template <typename T>
+constexpr auto detail::min_record_size(Encoding encoding) -> std::size_t
+{
+    if (encoding == Encoding::Fixed) {
+        return record_size<T>();
+    }
+    return std::apply([](auto... fields) { return (std::size_t { 0 } + ... + (s_varint<std::decay_t<decltype(std::declval<T&>().*fields)>> ? 1 : sizeof(std::declval<T&>().*fields))); }, schema<T>::fields);
+}
+
+template <typename T>
+auto encode(const T& value, Encoding encoding) -> std::string
+{
+    std::string bytes {};
+    bytes.reserve(16 + detail::record_size<T>());
+    detail::write_header(header_t { schema<T>::id, schema<T>::version, encoding, 1 }, bytes);
+    detail::write_record(value, encoding, bytes);
+    return bytes;
+}
+
+template <typename T>
+auto encode(const std::vector<T>& values, Encoding encoding) -> std::string
+{
+    std::string bytes {};
+    bytes.reserve(16 + values.size() * detail::record_size<T>());
+    detail::write_header(header_t { schema<T>::id, schema<T>::version, encoding, values.size() }, bytes);
+    for (const auto& value : values) {
+        detail::write_record(value, encoding, bytes);
+    }
+    return bytes;
+}
+
+template <typename T, typename F>
+auto decode(std::string_view frame, F&& function) -> std::size_t
+{
+    const header_t header { detail::read_header(frame) };
+    if (header.schema != schema<T>::id) {
+        throw error::codec_error { "unexpected schema " + std::to_string(header.schema) };
+    }
+    if (header.version != schema<T>::version) {
+        throw error::codec_error { "unsupported schema version " + std::to_string(header.version) };
+    }
+    // the count comes from the wire, so it is checked against the size before any record is handed out
+    if (header.count > (frame.size() / detail::min_record_size<T>(header.encoding))) {
+        throw error::codec_error { "record count exceeds the frame size" };
+    }
+    constexpr std::size_t size { detail::record_size<T>() };
+    if ((header.encoding == Encoding::Fixed) && (frame.size() != (header.count * size))) {
+        throw error::codec_error { "frame size does not match the record count" };
+    }
+    for (std::uint64_t i { 0 }; i < header.count; i++) {
+        function(detail::read_record<T>(header.encoding, frame));
+    }
+    if (!frame.empty()) {
+        throw error::codec_error { std::to_string(frame.size()) + " trailing bytes after the last record" };
+    }
+    return static_cast<std::size_t>(header.count);
+}
+
+template <typename T>
+auto decode(std::string_view frame) -> std::vector<T>
+{
+    std::vector<T> values {};
+    const header_t header { peek(frame) };
+    // the count comes from the wire, the reservation must not trust it beyond the actual size
+    values.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(header.count, frame.size())));
+    decode<T>(frame, [&values](T&& value) { values.emplace_back(std::move(value)); });
+    return values;
+}
+
+}
+
+#endif // CODEC_H
@@ -0,0 +1,197 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "muonpi/global.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace muonpi {
+
+/**
+ * @brief The executor class. A pool of worker threads which share tasks through work stealing.
+ * Every worker has its own task queues. Tasks posted from a worker go to its own queues,
+ * idle workers steal from the others. Tasks can be pinned to one worker, in which case they are never stolen.
+ * This is what thread_runner instances use when they are started on an executor.
+ * An executor saves threads, not time. A runner on its own thread reacts at least as fast, so dedicated threads
+ * remain the default. An executor pays off once there are many more mostly idle runners than cpus.
+ */
+class LIBMUONPI_PUBLIC executor {
+public:
+    enum class Priority {
+        Low,
+        Normal,
+        High
+    };
+
+    using task_t = std::function<void()>;
+
+    /**
+     * @brief executor
+     * @param workers The number of worker threads
+     */
+    explicit executor(std::size_t workers = std::thread::hardware_concurrency());
+
+    /**
+     * @brief executor Creates one worker per cpu and pins it to that cpu.
+     * @param cpus The cpus to pin the workers to
+     */
+    explicit executor(const std::vector<int>& cpus);
+
+    /**
+     * @brief ~executor Stops all workers and waits for them to finish. Tasks which did not run yet are discarded.
+     * Attached owners get notified afterwards, see attach.
+     */
+    ~executor();
+
+    executor(const executor&) = delete;
+    executor(executor&&) = delete;
+    auto operator=(const executor&) -> executor& = delete;
+    auto operator=(executor&&) -> executor& = delete;
+
+    /**
+     * @brief post Schedules a task
+     * @param task The task to execute
+     * @param priority Workers prefer tasks with higher priority
+     * @param worker The worker the task is pinned to, -1 lets any worker run it
+     */
+    void post(task_t task, Priority priority = Priority::Normal, int worker = -1);
+
+    /**
+     * @brief post_after Schedules a task once a delay elapsed
+     * @param delay The minimum delay before the task is scheduled
+     * @param task The task to execute
+     * @param priority Workers prefer tasks with higher priority
+     * @param worker The worker the task is pinned to, -1 lets any worker run it
+     */
+    void post_after(std::chrono::steady_clock::duration delay, task_t task, Priority priority = Priority::Normal, int worker = -1);
+
+    /**
+     * @brief create_timer Creates a timer which posts its task every time it expires. A new timer is not armed.
+     * Owners which need a timeout over and over should use one timer instead of posting delayed tasks.
+     * @param task The task to execute when the timer expires
+     * @param priority Workers prefer tasks with higher priority
+     * @param worker The worker the task is pinned to, -1 lets any worker run it
+     * @return An id to pass to arm_timer and destroy_timer
+     */
+    [[nodiscard]] auto create_timer(task_t task, Priority priority = Priority::Normal, int worker = -1) -> std::size_t;
+
+    /**
+     * @brief arm_timer Lets a timer expire once at a deadline, unless it is already armed to expire earlier
+     * @param id The id returned by create_timer
+     * @param deadline The time at which the timer should expire
+     */
+    void arm_timer(std::size_t id, std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief destroy_timer Removes a timer. A task it posted before might still run.
+     * @param id The id returned by create_timer
+     */
+    void destroy_timer(std::size_t id);
+
+    /**
+     * @brief size The number of worker threads
+     */
+    [[nodiscard]] auto size() const -> std::size_t;
+
+    /**
+     * @brief attach Registers a callback which is called if the executor gets destroyed before detach was called.
+     * Owners of tasks which repost themselves use it to learn that their tasks will never run again.
+     * The callback runs on the destroying thread, after all workers stopped.
+     * @param abandon The callback
+     * @return An id to pass to detach
+     */
+    [[nodiscard]] auto attach(std::function<void()> abandon) -> std::size_t;
+
+    /**
+     * @brief detach Removes a callback registered with attach
+     * @param id The id returned by attach
+     */
+    void detach(std::size_t id);
+
+private:
+    constexpr static std::size_t s_priorities { 3 };
+
+    struct worker_t {
+        std::mutex mutex {};
+        std::array<std::deque<task_t>, s_priorities> shared {};
+        std::array<std::deque<task_t>, s_priorities> pinned {};
+        std::atomic<std::size_t> pinned_count { 0 };
+        std::thread thread {};
+    };
+
+    struct timer_t {
+        task_t task {};
+        Priority priority {};
+        int worker {};
+        /**
+         * @brief once Timers created by post_after get removed after they expired
+         */
+        bool once { false };
+        std::optional<std::chrono::steady_clock::time_point> deadline {};
+    };
+
+    void start(std::size_t workers);
+
+    /**
+     * @brief arm Arms a timer, m_mutex has to be locked
+     * @return true if the timer expires before all others
+     */
+    [[nodiscard]] auto arm(std::size_t id, timer_t& timer, std::chrono::steady_clock::time_point deadline) -> bool;
+
+    void run(std::size_t index);
+
+    /**
+     * @brief take Gets the next task for a worker. Looks at the workers own queues first, then tries to steal.
+     * @param index The index of the worker
+     */
+    [[nodiscard]] auto take(std::size_t index) -> std::optional<task_t>;
+
+    /**
+     * @brief fire_timers Posts all timers which are due
+     */
+    void fire_timers();
+
+    /**
+     * @brief wake Wakes sleeping workers after a task was queued
+     * @param all Wake all workers instead of one
+     */
+    void wake(bool all);
+
+    std::vector<std::unique_ptr<worker_t>> m_workers {};
+    std::vector<int> m_cpus {};
+
+    /**
+     * @brief m_queued The number of queued tasks which any worker may take
+     */
+    std::atomic<std::size_t> m_queued { 0 };
+    std::atomic<std::size_t> m_sleeping { 0 };
+    std::atomic<std::size_t> m_next { 0 };
+    std::atomic<bool> m_running { true };
+
+    std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+    std::map<std::size_t, timer_t> m_timers {};
+    std::set<std::pair<std::chrono::steady_clock::time_point, std::size_t>> m_deadlines {};
+    std::size_t m_next_timer { 0 };
+    std::atomic<std::chrono::steady_clock::rep> m_next_deadline { std::chrono::steady_clock::time_point::max().time_since_epoch().count() };
+
+    std::mutex m_attached_mutex {};
+    std::map<std::size_t, std::function<void()>> m_attached {};
+    std::size_t m_next_attachment { 0 };
+};
+
+}
+
+#endif // EXECUTOR_H
@@ -0,0 +1,162 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include "muonpi/global.h"
+#include "muonpi/http_tools.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace muonpi::http {
+
+/**
+ * @brief The response_cache class. Keeps the responses of GET requests for some time, keyed on the request-target,
+ * so repeated requests do not run the handler again.
+ * Every cached response carries an ETag derived from its body. Requests whose If-None-Match header contains that ETag
+ * get answered with 304 Not Modified and no body.
+ * Only complete 200 responses with a string body are cached, and the responses of a handler must not depend on
+ * anything but the request-target. Whoever changes the underlying data can call invalidate to drop outdated responses early.
+ * A cache can be shared by several handlers and used from several threads at once.
+ * If responses get compressed, each compressed variant is kept as well, so it is only compressed once per coding.
+ * The variants are created with the compression settings of the first request needing them.
+ */
+class LIBMUONPI_PUBLIC response_cache {
+public:
+    struct configuration {
+        /**
+         * @brief ttl How long a response is served from the cache
+         */
+        std::chrono::milliseconds ttl { 5000 };
+        /**
+         * @brief max_entries The maximum number of cached responses
+         */
+        std::size_t max_entries { 256 };
+    };
+
+    struct statistics_t {
+        std::size_t hits { 0 };
+        std::size_t misses { 0 };
+        std::size_t not_modified { 0 };
+    };
+
+    response_cache();
+
+    explicit response_cache(configuration config);
+
+    /**
+     * @brief serve Answers a request from the cache, or calls the handler and caches its response
+     * @param req The request to answer
+     * @param handler Gets called without arguments if the response is not cached, has to return an any_response
+     */
+    template <typename F>
+    [[nodiscard]] auto serve(request_type& req, F&& handler) -> any_response;
+
+    /**
+     * @brief serve Answers a request from the cache, or calls the handler and caches its response.
+     * Responses get compressed according to the Accept-Encoding header of the request, see compress_response.
+     * A 304 Not Modified carries the ETag and Vary header the full response would have had.
+     * @param req The request to answer
+     * @param handler Gets called without arguments if the response is not cached, has to return an any_response
+     * @param compression How to compress responses, nullptr leaves them uncompressed
+     */
+    template <typename F>
+    [[nodiscard]] auto serve(request_type& req, F&& handler, const compression_t* compression) -> any_response;
+
+    /**
+     * @brief invalidate Drops all cached responses
+     */
+    void invalidate();
+
+    /**
+     * @brief invalidate Drops the cached response for one request-target
+     */
+    void invalidate(std::string_view target);
+
+    /**
+     * @brief statistics How many requests were answered from the cache, how many were not, and how many of them with 304
+     */
+    [[nodiscard]] auto statistics() const -> statistics_t;
+
+    /**
+     * @brief etag The ETag of a body, including the quotes
+     */
+    [[nodiscard]] static auto etag(std::string_view body) -> std::string;
+
+private:
+    struct entry_t {
+        response_type response {};
+        std::string etag {};
+        std::chrono::steady_clock::time_point expires {};
+        /**
+         * @brief variants The response for clients accepting no coding, gzip and deflate. Created on first use, never changed afterwards.
+         */
+        mutable std::array<std::optional<response_type>, 3> variants {};
+        mutable std::mutex mutex {};
+    };
+
+    [[nodiscard]] auto lookup(const std::string& key) -> std::shared_ptr<const entry_t>;
+
+    [[nodiscard]] auto store(std::string key, response_type response) -> std::shared_ptr<const entry_t>;
+
+    /**
+     * @brief respond Creates the response to a request from a cached response, 304 if the client has it already
+     * @param compression How to compress the response, nullptr leaves it uncompressed
+     */
+    [[nodiscard]] auto respond(const request_type& req, const entry_t& entry, const compression_t* compression) -> response_type;
+
+    /**
+     * @brief variant The response for clients accepting a coding, compressed on first use
+     * @param coding The accepted coding, nothing if the client accepts none
+     */
+    [[nodiscard]] static auto variant(const entry_t& entry, std::optional<Coding> coding, const compression_t& compression) -> const response_type&;
+
+    configuration m_config {};
+
+    mutable std::mutex m_mutex {};
+    std::unordered_map<std::string, std::shared_ptr<const entry_t>> m_entries {};
+
+    std::atomic<std::size_t> m_hits { 0 };
+    std::atomic<std::size_t> m_misses { 0 };
+    std::atomic<std::size_t> m_not_modified { 0 };
+};
+
+// +++++++++++++++++++++++++++++++
+// implementation part starts here
+// +++++++++++++++++++++++++++++++
+
+template <typename F>
+auto response_cache::serve(request_type& req, F&& handler) -> any_response
+{
+    return serve(req, std::forward<F>(handler), nullptr);
+}
+
+template <typename F>
+auto response_cache::serve(request_type& req, F&& handler, const compression_t* compression) -> any_response
+{
+    if (req.method() != http_verb::get) {
+        return handler();
+    }
+    std::string key { req.target() };
+    if (const auto cached { lookup(key) }; cached != nullptr) {
+        m_hits++;
+        return respond(req, *cached, compression);
+    }
+    m_misses++;
+    any_response fresh { handler() };
+    auto* plain { std::get_if<response_type>(&fresh) };
+    if ((plain == nullptr) || (plain->result() != http_status::ok) || plain->chunked()) {
+        return fresh;
+    }
+    return respond(req, *store(std::move(key), std::move(*plain)), compression);
+}
+
+}
+
+#endif // HTTP_CACHE_H
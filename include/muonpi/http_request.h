@@ -5,7 +5,12 @@
 #include "muonpi/http_tools.h"
 #include "muonpi/log.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace muonpi::http {
 struct destination_t {
@@ -23,6 +28,91 @@ struct field_t {
 
 [[nodiscard]] LIBMUONPI_PUBLIC auto http_request(destination_t destination, std::string body, bool ssl = false, std::vector<field_t> fields = {}) -> response_type;
 
+/**
+ * @brief The connection_pool class. Keeps HTTP/1.1 keep-alive connections to one host open,
+ * so consecutive requests do not each pay for name resolution and a new TCP connection.
+ * The resolved endpoints are cached for a configurable time. A connection which fails on reuse,
+ * for example because the server closed it while it was idle, is replaced once by a new one.
+ * Connecting, sending and receiving each time out after configuration::timeout.
+ * Requests can be made from several threads at once, each uses its own connection.
+ * Only plain HTTP is supported.
+ */
+class LIBMUONPI_PUBLIC connection_pool {
+public:
+    struct configuration {
+        std::string host {};
+        int port { 80 };
+        /**
+         * @brief max_connections The maximum number of connections open at the same time.
+         * Further requests wait for a connection to become free.
+         */
+        std::size_t max_connections { 4 };
+        /**
+         * @brief resolve_interval How long resolved endpoints are used before the host is resolved again
+         */
+        std::chrono::seconds resolve_interval { 300 };
+        /**
+         * @brief timeout How long connecting, sending a request and receiving its response may take each
+         */
+        std::chrono::milliseconds timeout { std::chrono::seconds { 10 } };
+    };
+
+    explicit connection_pool(configuration config);
+
+    ~connection_pool();
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool(connection_pool&&) = delete;
+    auto operator=(const connection_pool&) -> connection_pool& = delete;
+    auto operator=(connection_pool&&) -> connection_pool& = delete;
+
+    /**
+     * @brief request Sends a request over a pooled connection and waits for the response
+     * @param method The method of the request
+     * @param target The target of the request
+     * @param body The body of the request
+     * @param fields Additional header fields
+     * @throws beast::system_error if the request failed or timed out on a new connection
+     */
+    [[nodiscard]] auto request(http_verb method, const std::string& target, std::string body, const std::vector<field_t>& fields = {}) -> response_type;
+
+    /**
+     * @brief open The number of currently open connections
+     */
+    [[nodiscard]] auto open() const -> std::size_t;
+
+private:
+    struct connection;
+
+    /**
+     * @brief acquire Takes an idle connection, or opens a new one if the limit allows it
+     * @param fresh Gets set to true if the connection was newly opened
+     */
+    [[nodiscard]] auto acquire(bool& fresh) -> std::unique_ptr<connection>;
+
+    /**
+     * @brief release Returns a connection to the pool. A null pointer marks a connection as closed.
+     */
+    void release(std::unique_ptr<connection> conn);
+
+    /**
+     * @brief endpoints The cached endpoints of the host, resolves them again if they are outdated
+     */
+    [[nodiscard]] auto endpoints(bool refresh) -> tcp::resolver::results_type;
+
+    configuration m_config {};
+    net::io_context m_ioc {};
+
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_released {};
+    std::vector<std::unique_ptr<connection>> m_idle {};
+    std::size_t m_open { 0 };
+
+    std::mutex m_resolve_mutex {};
+    tcp::resolver::results_type m_endpoints {};
+    std::chrono::steady_clock::time_point m_resolved {};
+};
+
 }
 
 #endif // HTTP_REQUEST_H
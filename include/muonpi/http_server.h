@@ -2,13 +2,18 @@
 #define REST_SERVICE_H
 
 #include "muonpi/global.h"
+#include "muonpi/http_cache.h"
 #include "muonpi/http_tools.h"
 #include "muonpi/log.h"
 #include "muonpi/threadrunner.h"
 
+#include <array>
+#include <memory>
 #include <queue>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 namespace muonpi::http {
@@ -18,7 +23,9 @@ class LIBMUONPI_PUBLIC http_response {
 public:
     enum class content_type {
         html,
-        json
+        json,
+        text,
+        binary
     };
 
     http_response(request_type& req, content_type content, std::string application_name = "libmuonpi-" + Version::libmuonpi::string())
@@ -33,6 +40,12 @@ public:
         case content_type::json:
             content_type_string = "text/json";
             break;
+        case content_type::text:
+            content_type_string = "text/plain";
+            break;
+        case content_type::binary:
+            content_type_string = "application/octet-stream";
+            break;
         }
         m_response.set(beast::http::field::content_type, content_type_string);
         m_response.keep_alive(req.keep_alive());
@@ -55,19 +68,149 @@ public:
         return std::move(commit(std::move(body)));
     }
 
+    /**
+     * @brief stream Creates a response whose body gets generated while it is sent.
+     * HTTP/1.1 clients receive it with chunked transfer encoding, for older clients the connection gets closed after the body.
+     * @param producer Gets called repeatedly to append the next part of the body, see producer_body
+     * @param chunk_size The size of the chunks
+     */
+    [[nodiscard]] auto stream(producer_body::producer_t producer, std::size_t chunk_size = producer_body::s_chunk_size) -> stream_response_type
+    {
+        stream_response_type response { std::move(m_response.base()) };
+        response.body().producer = std::move(producer);
+        response.body().chunk_size = chunk_size;
+        if (response.version() >= 11) {
+            response.chunked(true);
+        } else {
+            response.keep_alive(false);
+        }
+        return response;
+    }
+
+    /**
+     * @brief file Creates a response whose body gets read from a file while it is sent
+     * @param path The path of the file
+     * @throws boost::system::system_error if the file could not be opened.
+     * If a handler lets it escape, the client gets a 500 response. Handlers which want to answer with 404 have to catch it.
+     */
+    [[nodiscard]] auto file(const std::string& path) -> file_response_type
+    {
+        file_response_type response { std::move(m_response.base()) };
+        beast::error_code ec {};
+        response.body().open(path.c_str(), beast::file_mode::scan, ec);
+        if (ec) {
+            throw boost::system::system_error { ec, "Could not open '" + path + "'" };
+        }
+        response.prepare_payload();
+        return response;
+    }
+
 private:
     response_type m_response;
 };
 
+/**
+ * @brief The path_view class. The part of a request-target remaining after the path of a handler, and the parameters captured on the way.
+ * Only refers to the request-target, so it must not outlive the handler call.
+ */
+class LIBMUONPI_PUBLIC path_view {
+public:
+    /**
+     * @brief s_max_parameters The maximum number of parameters one route may capture
+     */
+    static constexpr std::size_t s_max_parameters { 8 };
+
+    path_view() = default;
+
+    /**
+     * @brief path_view
+     * @param remaining The remaining request-target. One leading separator gets removed.
+     */
+    explicit path_view(std::string_view remaining);
+
+    /**
+     * @brief empty true if no segment remains
+     */
+    [[nodiscard]] auto empty() const -> bool;
+
+    /**
+     * @brief size The number of remaining segments
+     */
+    [[nodiscard]] auto size() const -> std::size_t;
+
+    /**
+     * @brief front The first remaining segment
+     */
+    [[nodiscard]] auto front() const -> std::string_view;
+
+    /**
+     * @brief operator [] A remaining segment
+     * @param index The index of the segment, has to be smaller than size()
+     */
+    [[nodiscard]] auto operator[](std::size_t index) const -> std::string_view;
+
+    /**
+     * @brief remaining The remaining segments as they appeared in the request-target
+     */
+    [[nodiscard]] auto remaining() const -> std::string_view;
+
+    /**
+     * @brief parameter The value captured by a parameter segment of the route
+     * @param name The name of the parameter, without the braces
+     * @return The value, empty if the route has no such parameter
+     */
+    [[nodiscard]] auto parameter(std::string_view name) const -> std::string_view;
+
+    /**
+     * @brief operator std::queue<std::string> Copies the remaining segments, for handlers written against the queue interface.
+     */
+    operator std::queue<std::string>() const;
+
+private:
+    friend class http_server;
+
+    [[nodiscard]] static auto trim(std::string_view path) -> std::string_view;
+
+    std::string_view m_remaining {};
+    std::array<std::pair<std::string_view, std::string_view>, s_max_parameters> m_parameters {};
+    std::size_t m_parameter_count { 0 };
+};
+
+/**
+ * @brief The path_handler struct. Serves the requests for one path.
+ * The path consists of one or more segments separated by '/'. A segment of the form '{name}' matches any single segment
+ * and captures it as a parameter, a final '*' matches all remaining segments, including none.
+ * Handlers without a path match a single segment using the matches predicate instead.
+ * Routes are matched segment by segment, literal segments take precedence over parameters, parameters over wildcards
+ * and wildcards over predicates. A handler whose path ends early only serves the request if no longer route matches.
+ * The paths of the children are relative to the path of their parent.
+ */
 struct LIBMUONPI_PUBLIC path_handler {
+    std::string path {};
     std::function<bool(std::string_view path)> matches {};
-    std::function<response_type(request_type& req, const std::queue<std::string>& path)> handle {};
+    std::function<any_response(request_type& req, const path_view& path)> handle {};
     std::string name {};
     bool requires_auth { false };
     std::function<bool(request_type& req, std::string_view username, std::string_view password)> authenticate {};
     std::vector<path_handler> children {};
+    /**
+     * @brief cache If set, the responses of this handler get served from the cache. See response_cache.
+     */
+    std::shared_ptr<response_cache> cache {};
+    /**
+     * @brief compress Whether the responses of this handler may be compressed, see http_server::configuration::compression
+     */
+    bool compress { true };
 };
 
+/**
+ * @brief metrics_handler Creates a handler which serves a JSON snapshot of all stages in the metrics registry.
+ * Every stage carries a timestamp in seconds of the monotonic clock, pollers get the throughput
+ * from the difference of items_out between two of their snapshots, divided by the difference of the timestamps.
+ * @param name The path segment under which the snapshot is served
+ */
+[[nodiscard]] LIBMUONPI_PUBLIC auto metrics_handler(std::string name = "metrics") -> path_handler;
+
 class LIBMUONPI_PUBLIC http_server : public thread_runner {
 public:
     struct configuration {
@@ -77,10 +220,37 @@ public:
         std::string cert {};
         std::string privkey {};
         std::string fullchain {};
+        /**
+         * @brief threads The number of threads serving the connections.
+         * With more than one thread, the handlers may get called concurrently.
+         */
+        std::size_t threads { 1 };
+
+        using compression_t = http::compression_t;
+
+        /**
+         * @brief compression Controls the compression of responses for clients which accept it.
+         * Only complete responses with textual content get compressed, streamed and file responses are sent as they are.
+         * Responses served from a response_cache get compressed by the cache.
+         */
+        compression_t compression {};
     };
 
     http_server(configuration config);
 
+    ~http_server() override;
+
+    http_server(const http_server&) = delete;
+    http_server(http_server&&) = delete;
+    auto operator=(const http_server&) -> http_server& = delete;
+    auto operator=(http_server&&) -> http_server& = delete;
+
+    /**
+     * @brief add_handler Adds a handler and its children to the routes
+     * The server may already receive requests, so this waits until no request is being handled.
+     * Handlers must not call it themselves.
+     * @throws std::invalid_argument if the path of a handler is malformed
+     */
     void add_handler(path_handler han);
 
 protected:
@@ -91,14 +261,38 @@ protected:
     void on_stop() override;
 
 private:
-    [[nodiscard]] auto handle(request_type req) const -> response_type;
+    struct node;
+    struct endpoint;
+
+    /**
+     * @brief handle Routes a request to its handler
+     * @param compress Gets set to false if the handler does not want its response compressed
+     */
+    [[nodiscard]] auto handle(request_type& req, bool& compress) const -> any_response;
+
+    /**
+     * @brief validate Checks the paths of a handler and its children
+     * @param parameters The number of parameters captured by the parents of the handler
+     * @throws std::invalid_argument if a path is malformed
+     */
+    static void validate(const path_handler& handler, std::size_t parameters);
+
+    /**
+     * @brief compile Adds a handler and its children to a node of the routes. The handler has to be validated before.
+     */
+    static void compile(node& level, path_handler handler);
 
-    [[nodiscard]] auto handle(request_type req, std::queue<std::string> path, const std::vector<path_handler>& handlers) const -> response_type;
-    [[nodiscard]] auto handle(request_type req, std::queue<std::string> path, const path_handler& hand) const -> response_type;
+    /**
+     * @brief find Finds the endpoint serving the beginning of a path
+     * @param path The path to match, gets set to the part remaining after the endpoint
+     * @param view Collects the values of the parameters
+     */
+    [[nodiscard]] static auto find(const node& current, std::string_view& path, path_view& view) -> const endpoint*;
 
-    std::vector<path_handler> m_handler {};
+    std::unique_ptr<node> m_routes;
+    mutable std::shared_mutex m_routes_mutex {};
 
-    net::io_context m_ioc { 1 };
+    net::io_context m_ioc;
     ssl::context m_ctx { ssl::context::tlsv12 };
     tcp::acceptor m_acceptor { m_ioc };
     tcp::endpoint m_endpoint;
@@ -7,20 +7,21 @@
 #include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
-#include <boost/version.hpp>
 
-#if BOOST_VERSION < 106900
-#include <boost/asio/connect.hpp>
-#include <boost/asio/ssl/stream.hpp>
-#else
 #include <boost/beast/ssl.hpp>
-#endif
 
 #include <boost/asio/ssl.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/config.hpp>
 
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
 namespace muonpi::http {
 
 namespace beast = boost::beast;
@@ -38,14 +39,140 @@ using http_status = beast::http::status;
 
 void fail(beast::error_code ec, const std::string& what);
 
+/**
+ * @brief The producer_body struct. A body of unknown size which gets generated piece by piece while it is sent.
+ * At most one chunk of the body is held in memory at any time, regardless of the size of the whole body.
+ * The producer gets called from the network thread, so it should not block for long.
+ */
+struct producer_body {
+    /**
+     * @brief producer_t Appends the next part of the body to the buffer. Returns false once the body is complete.
+     * An exception aborts the response, the connection gets closed.
+     */
+    using producer_t = std::function<bool(std::string& buffer)>;
+
+    /**
+     * @brief s_chunk_size The default size of the chunks
+     */
+    static constexpr std::size_t s_chunk_size { 64 * 1024 };
+
+    struct value_type {
+        producer_t producer {};
+        /**
+         * @brief chunk_size The producer gets called until a chunk has at least this size
+         */
+        std::size_t chunk_size { s_chunk_size };
+    };
+
+    class writer {
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template <bool isRequest, class Fields>
+        writer(beast::http::header<isRequest, Fields>& /*header*/, value_type& body)
+            : m_body { body }
+        {
+        }
+
+        void init(beast::error_code& ec)
+        {
+            ec = {};
+            m_buffer.reserve(m_body.chunk_size);
+        }
+
+        auto get(beast::error_code& ec) -> boost::optional<std::pair<const_buffers_type, bool>>
+        {
+            ec = {};
+            // the serializer has consumed the previous chunk before asking for the next one
+            m_buffer.clear();
+            try {
+                while (m_more && (m_buffer.size() < m_body.chunk_size)) {
+                    m_more = m_body.producer(m_buffer);
+                }
+            } catch (std::exception& e) {
+                log::warning("http") << "Aborting streamed response: " << e.what();
+                ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+                return boost::none;
+            }
+            if (m_buffer.empty()) {
+                return boost::none;
+            }
+            return std::make_pair(const_buffers_type { m_buffer.data(), m_buffer.size() }, m_more);
+        }
+
+    private:
+        value_type& m_body;
+        std::string m_buffer {};
+        bool m_more { true };
+    };
+};
+
+using file_response_type = beast::http::response<beast::http::file_body>;
+using stream_response_type = beast::http::response<producer_body>;
+
+/**
+ * @brief any_response The responses a handler may return. Bodies of files and producers get sent incrementally.
+ */
+using any_response = std::variant<response_type, file_response_type, stream_response_type>;
+
+/**
+ * @brief The Coding enum. The content codings supported by compress.
+ */
+enum class Coding {
+    Gzip,
+    Deflate
+};
+
+/**
+ * @brief compress Compresses data for use as a HTTP body
+ * @param data The data to compress
+ * @param coding The content coding. Deflate produces the zlib format, as HTTP requires.
+ * @param level The compression level, from 1 for the fastest to 9 for the smallest output. -1 selects the zlib default.
+ * @throws std::runtime_error if the compression failed
+ */
+[[nodiscard]] auto compress(std::string_view data, Coding coding = Coding::Gzip, int level = -1) -> std::string;
+
+/**
+ * @brief coding_name The name of a content coding, as used in the HTTP headers
+ */
+[[nodiscard]] auto coding_name(Coding coding) -> std::string_view;
+
+/**
+ * @brief accepted_coding Selects the content coding for a response from the Accept-Encoding header of the request.
+ * gzip is preferred over deflate if both are equally acceptable.
+ * @param accept_encoding The value of the Accept-Encoding header
+ * @return The coding to use, nothing if the client accepts neither
+ */
+[[nodiscard]] auto accepted_coding(std::string_view accept_encoding) -> std::optional<Coding>;
+
+/**
+ * @brief The compression_t struct. Controls the compression of responses for clients which accept it.
+ */
+struct compression_t {
+    bool enabled { true };
+    /**
+     * @brief level The zlib compression level, from 1 for the fastest to 9 for the smallest output
+     */
+    int level { 6 };
+    /**
+     * @brief min_bytes Smaller bodies are sent uncompressed
+     */
+    std::size_t min_bytes { 1024 };
+};
+
+/**
+ * @brief compress_response Compresses a complete response with the coding the request accepts, if it is worth it.
+ * Only textual bodies of at least compression.min_bytes are considered. Those get Vary: Accept-Encoding, even if they stay uncompressed.
+ * A compressed response has its ETag weakened. Responses which have a Content-Encoding or vary on Accept-Encoding already are left alone.
+ * @param response The response to compress
+ * @param accept_encoding The value of the Accept-Encoding header of the request
+ * @param compression The settings to use
+ */
+void compress_response(response_type& response, std::string_view accept_encoding, const compression_t& compression);
+
 namespace detail {
-#if BOOST_VERSION < 106900
-    using ssl_stream_t = ssl::stream<tcp::socket>;
-    using tcp_stream_t = tcp::socket;
-#else
     using ssl_stream_t = beast::ssl_stream<beast::tcp_stream>;
     using tcp_stream_t = beast::tcp_stream;
-#endif
 }
 
 }
@@ -3,16 +3,36 @@
 
 #include "muonpi/global.h"
 
+#include "muonpi/notifier.h"
+#include "muonpi/threadrunner.h"
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <memory>
 #include <mutex>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <variant>
 #include <vector>
 
+namespace muonpi::http {
+class connection_pool;
+}
+
 namespace muonpi::link {
 
-class influx {
+/**
+ * @brief The influx class. Writes measurements to an influx database.
+ * Committed entries are collected and written in batches by a background thread.
+ * A batch is sent once it reaches the configured number of lines or bytes, or once the linger time passed.
+ * Failed writes are retried, committed entries are only discarded if the buffer limit is reached
+ * or the database rejects them as malformed. Batches the database considers too large are split up.
+ * Remaining entries are written when the link is destroyed.
+ */
+class influx : public thread_runner {
 public:
     struct tag {
         std::string name;
@@ -31,39 +51,142 @@ public:
             std::string password {};
         } login;
         std::string database {};
+        /**
+         * @brief connections The maximum number of keep-alive connections to the database host
+         */
+        std::size_t connections { 2 };
+        /**
+         * @brief The batch_t struct. Controls how committed entries are combined into writes.
+         */
+        struct batch_t {
+            /**
+             * @brief max_lines A batch is sent as soon as it contains this many lines
+             */
+            std::size_t max_lines { 5000 };
+            /**
+             * @brief max_bytes A batch is sent as soon as it reaches this size. No single write is larger.
+             */
+            std::size_t max_bytes { 1024 * 1024 };
+            /**
+             * @brief linger The maximum time an entry waits for others before it is sent
+             */
+            std::chrono::milliseconds linger { 1000 };
+            /**
+             * @brief max_buffer_bytes The maximum size of all entries not yet written. Further entries are rejected.
+             */
+            std::size_t max_buffer_bytes { 64 * 1024 * 1024 };
+            /**
+             * @brief retry_interval The time to wait after a failed write before trying again
+             */
+            std::chrono::milliseconds retry_interval { 5000 };
+        } batch;
+
+        /**
+         * @brief The compression_t struct. Controls the gzip compression of the request bodies.
+         */
+        struct compression_t {
+            /**
+             * @brief enabled Whether request bodies get compressed at all
+             */
+            bool enabled { false };
+            /**
+             * @brief level The zlib compression level, from 1 for the fastest to 9 for the smallest output
+             */
+            int level { 6 };
+            /**
+             * @brief min_bytes Smaller bodies are sent uncompressed, since the gzip overhead would outweigh the saving
+             */
+            std::size_t min_bytes { 1024 };
+        } compression;
     };
 
+    /**
+     * @brief The entry class. Builds one line of the influx line protocol.
+     * Names, tag values and string field values are escaped as the line protocol requires.
+     * The line is written directly into buffers which are reused by later entries of the same thread,
+     * so building an entry does not allocate once the buffers have grown to their working size.
+     */
     class entry {
     public:
         entry() = delete;
+        ~entry();
+
+        entry(entry&&) noexcept = default;
+        entry(const entry&) = delete;
+        auto operator=(entry&&) -> entry& = delete;
+        auto operator=(const entry&) -> entry& = delete;
 
         auto operator<<(const tag& tag) -> entry&;
 
         template <typename T>
         auto operator<<(const field<T>& field) -> entry&
         {
-            m_fields << ',' << field.name << "=";
-            if constexpr (std::is_same_v<T, std::string>) {
-                m_fields << '"' << field.value << '"';
+            std::string& fields { m_buffer->fields };
+            if (!fields.empty()) {
+                fields.push_back(',');
+            }
+            escape(field.name, s_name_special, fields);
+            fields.push_back('=');
+            if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                fields.push_back('"');
+                escape(field.value, s_string_special, fields);
+                fields.push_back('"');
             } else if constexpr (std::is_same_v<T, bool>) {
-                m_fields << (field.value ? 't' : 'f');
+                fields.push_back(field.value ? 't' : 'f');
             } else if constexpr (std::is_floating_point_v<T>) {
-                m_fields << field.value;
+                append_number(field.value, fields);
             } else if constexpr (std::is_integral_v<T>) {
                 if constexpr (sizeof(T) < 2) {
-                    m_fields << static_cast<std::int32_t>(field.value) << 'i';
+                    append_number(static_cast<std::int32_t>(field.value), fields);
                 } else {
-                    m_fields << field.value << 'i';
+                    append_number(field.value, fields);
                 }
+                fields.push_back('i');
             }
             return *this;
         }
 
+        /**
+         * @brief commit Hands the finished line to the link. The entry can be committed again with another timestamp.
+         * @param timestamp The timestamp of the measurement
+         * @return false if the entry has no fields or could not be queued
+         */
         [[nodiscard]] auto commit(std::int_fast64_t timestamp) -> bool;
 
     private:
-        std::ostringstream m_tags {};
-        std::ostringstream m_fields {};
+        struct buffer_t {
+            std::string tags {};
+            std::string fields {};
+        };
+
+        static constexpr std::string_view s_measurement_special { ", " };
+        static constexpr std::string_view s_name_special { ",= " };
+        static constexpr std::string_view s_string_special { "\"\\" };
+
+        /**
+         * @brief escape Appends a text, prefixing all special characters with a backslash
+         */
+        static void escape(std::string_view text, std::string_view special, std::string& out);
+
+        template <typename T>
+        static void append_number(T value, std::string& out);
+
+        /**
+         * @brief pool The buffers which are currently unused in the current thread
+         */
+        [[nodiscard]] static auto pool() -> std::vector<std::unique_ptr<buffer_t>>&;
+
+        /**
+         * @brief acquire Takes a buffer from the pool of the current thread
+         */
+        [[nodiscard]] static auto acquire() -> std::unique_ptr<buffer_t>;
+
+        /**
+         * @brief release Puts a buffer back into the pool of the current thread
+         */
+        static void release(std::unique_ptr<buffer_t> buffer);
+
+        std::unique_ptr<buffer_t> m_buffer { nullptr };
 
         influx& m_link;
 
@@ -74,20 +197,90 @@ public:
 
     influx(configuration config);
     influx();
-    ~influx();
+    ~influx() override;
 
     [[nodiscard]] auto measurement(const std::string& measurement) -> entry;
 
+    /**
+     * @brief flush Makes the background thread write all committed entries now
+     */
+    void flush();
+
+    /**
+     * @brief dropped The number of entries which were discarded
+     */
+    [[nodiscard]] auto dropped() const -> std::size_t;
+
+protected:
+    [[nodiscard]] auto step() -> int override;
+
+    [[nodiscard]] auto post_run() -> int override;
+
+    void on_stop() override;
+
 private:
-    [[nodiscard]] auto send_string(const std::string& query) const -> bool;
+    enum class Result {
+        Written,
+        Rejected,
+        TooLarge,
+        Failed
+    };
+
+    /**
+     * @brief enqueue Adds a line to the buffer
+     * @return false if the buffer is full
+     */
+    [[nodiscard]] auto enqueue(std::string_view line) -> bool;
+
+    /**
+     * @brief write_pending Sends the buffered lines in batches. Only called from the influx thread.
+     * @return false if a write failed and should be retried later
+     */
+    [[nodiscard]] auto write_pending() -> bool;
+
+    [[nodiscard]] auto send_string(const std::string& query) -> Result;
 
     static constexpr short s_port { 8086 };
 
-    std::mutex m_mutex;
+    mutable std::mutex m_mutex;
 
     configuration m_config {};
+    std::string m_target {};
+    std::unique_ptr<http::connection_pool> m_pool { nullptr };
+
+    std::string m_buffer {};
+    std::size_t m_lines { 0 };
+    std::size_t m_sending_bytes { 0 };
+    std::size_t m_dropped { 0 };
+    bool m_flush { false };
+    notifier m_wakeup {};
+
+    std::string m_sending {};
+    bool m_failing { false };
+    std::chrono::steady_clock::time_point m_last_attempt {};
 };
 
+// +++++++++++++++++++++++++++++++
+// implementation part starts here
+// +++++++++++++++++++++++++++++++
+
+template <typename T>
+void influx::entry::append_number(T value, std::string& out)
+{
+    // large enough for any 64 bit integer and the shortest representation of any double
+    constexpr std::size_t digits { 32 };
+    std::array<char, digits> text {};
+#if !defined(__cpp_lib_to_chars)
+    if constexpr (std::is_floating_point_v<T>) {
+        const int length { std::snprintf(text.data(), text.size(), "%.17g", static_cast<double>(value)) };
+        out.append(text.data(), static_cast<std::size_t>(length));
+        return;
+    }
+#endif
+    const auto result { std::to_chars(text.data(), text.data() + text.size(), value) };
+    out.append(text.data(), result.ptr);
+}
+
 }
 
 #endif // INFLUX_H
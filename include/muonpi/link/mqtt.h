@@ -3,15 +3,25 @@
 
 #include "muonpi/global.h"
 
+#include "muonpi/link/spool.h"
+#include "muonpi/link/topic_trie.h"
+#include "muonpi/lockfree_queue.h"
 #include "muonpi/threadrunner.h"
 
+#include <atomic>
 #include <chrono>
-#include <future>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
+#include <random>
 #include <regex>
 #include <string>
+#include <string_view>
 
 #include <mosquitto.h>
 
@@ -58,6 +68,34 @@ public:
         Error
     };
 
+    /**
+     * @brief The QoS enum. The mqtt delivery guarantees.
+     */
+    enum class QoS : int {
+        AtMostOnce = 0,
+        AtLeastOnce = 1,
+        ExactlyOnce = 2
+    };
+
+    /**
+     * @brief The publish_options_t struct. Controls how the messages of a publisher are sent.
+     */
+    struct publish_options_t {
+        /**
+         * @brief qos The delivery guarantee. Messages sent with QoS::AtMostOnce are not spooled while disconnected.
+         */
+        QoS qos { QoS::AtLeastOnce };
+        /**
+         * @brief retain The broker keeps the last message and hands it to new subscribers.
+         */
+        bool retain { false };
+        /**
+         * @brief topic_alias Replaces the topic with a two byte alias after the first message. Requires configuration::mqtt5.
+         * Only applies to QoS::AtMostOnce. Other messages may be sent again after a reconnect, when the alias is no longer valid.
+         */
+        bool topic_alias { false };
+    };
+
     struct configuration {
         std::string host {};
         int port { 1883 };
@@ -65,9 +103,84 @@ public:
             std::string username {};
             std::string password {};
         } login;
+        /**
+         * @brief max_retries The number of consecutive failed connection attempts after which the link gives up
+         */
         std::size_t max_retries { 10 };
         std::chrono::seconds timeout { 3 };
+        /**
+         * @brief The reconnect_t struct. Controls the delay between connection attempts.
+         * The delay starts at initial and grows by multiplier with every failed attempt, up to maximum.
+         * Each delay is shortened by a random fraction of up to jitter, so many clients losing their
+         * connection at the same time do not return to the broker at the same time.
+         * The mqtt thread drives the network loop of mosquitto itself, so this is the only reconnect logic.
+         */
+        struct reconnect_t {
+            std::chrono::milliseconds initial { 500 };
+            std::chrono::milliseconds maximum { std::chrono::seconds { 60 } };
+            double multiplier { 2.0 };
+            double jitter { 0.5 };
+        } reconnect;
         int keepalive { 60 };
+        /**
+         * @brief The outbound_t struct. Controls the queue used by publisher::publish_async.
+         */
+        struct outbound_t {
+            /**
+             * @brief capacity The maximum number of queued messages
+             */
+            std::size_t capacity { 4096 };
+            /**
+             * @brief max_batch_bytes A combined message is sent as soon as it reaches this size
+             */
+            std::size_t max_batch_bytes { 64 * 1024 };
+            /**
+             * @brief linger How long the mqtt thread waits for more messages after the first one arrived
+             */
+            std::chrono::microseconds linger { 1000 };
+        } outbound;
+        /**
+         * @brief offline_spool Messages which can not be sent are stored here, with their QoS and retain flag, and sent once the connection is back.
+         * An empty directory disables the spool.
+         */
+        spool::configuration offline_spool {};
+        /**
+         * @brief replay_rate The maximum number of spooled messages sent per second after reconnecting. Zero means unlimited.
+         * Only applies to the backlog. Messages published while connected are sent directly,
+         * so they may arrive before older messages which are still in the spool.
+         */
+        std::size_t replay_rate { 1000 };
+        /**
+         * @brief mqtt5 Connect with protocol version 5 instead of 3.1.1
+         */
+        bool mqtt5 { false };
+        /**
+         * @brief topic_alias_maximum The number of topic aliases used per connection.
+         * The topic alias maximum the broker announces when connecting is never exceeded.
+         */
+        std::uint16_t topic_alias_maximum { 10 };
+        /**
+         * @brief client_id_suffix Appended to the generated client id, so several connections can be opened for the same station.
+         */
+        std::string client_id_suffix {};
+    };
+
+    /**
+     * @brief The statistics_t struct. Describes the history of the connection.
+     */
+    struct statistics_t {
+        /**
+         * @brief reconnects The number of times the connection was established again after it was lost
+         */
+        std::size_t reconnects { 0 };
+        /**
+         * @brief attempts The total number of connection attempts
+         */
+        std::size_t attempts { 0 };
+        /**
+         * @brief downtime The total time the connection was lost, including the current outage
+         */
+        std::chrono::milliseconds downtime { 0 };
     };
 
     struct message_t {
@@ -81,6 +194,25 @@ public:
         std::string content {};
     };
 
+    /**
+     * @brief The message_view struct. One line of a received message, without copies.
+     * The views point into a reference counted buffer which holds the topic and the complete payload.
+     * They are valid as long as a copy of buffer exists, which lets callbacks keep messages beyond the call cheaply.
+     */
+    struct message_view {
+        std::string_view topic {};
+        std::string_view content {};
+        std::shared_ptr<const std::string> buffer {};
+
+        /**
+         * @brief to_message Copies the viewed data into an owning message_t
+         */
+        [[nodiscard]] auto to_message() const -> message_t
+        {
+            return message_t { std::string { topic }, std::string { content } };
+        }
+    };
+
     /**
      * @brief The publisher class. Only gets instantiated from within the mqtt class.
      */
@@ -92,6 +224,13 @@ public:
         {
         }
 
+        publisher(mqtt* link, const std::string& topic, publish_options_t options)
+            : m_link { link }
+            , m_topic { topic }
+            , m_options { options }
+        {
+        }
+
         /**
          * @brief publish Publish a message
          * @param content The content to send
@@ -122,12 +261,34 @@ public:
          */
         auto publish(const std::string& subtopic, const std::vector<std::string>& content) -> bool;
 
+        /**
+         * @brief publish_async Queues a message which the mqtt thread publishes later.
+         * Messages queued for the same topic within the linger time are combined into one,
+         * separated by newlines like the vector overload of publish. Binary payloads have to be sent with publish.
+         * @param content The content to send
+         * @return false if the outbound queue is full
+         */
+        auto publish_async(std::string content) -> bool;
+
+        /**
+         * @brief publish_async Queues a message which the mqtt thread publishes later.
+         * @param subtopic Subtopic to add to the basetopic specified in the constructor
+         * @param content The content to send
+         * @return false if the outbound queue is full
+         */
+        auto publish_async(const std::string& subtopic, std::string content) -> bool;
+
         /**
          * @brief get_publish_topic Gets the topic under which the publisher publishes messages
          * @return a std::string containing the publish topic
          */
         [[nodiscard]] auto get_publish_topic() const -> const std::string&;
 
+        /**
+         * @brief get_options Gets the options used for all messages of this publisher
+         */
+        [[nodiscard]] auto get_options() const -> const publish_options_t&;
+
         publisher() = default;
 
     private:
@@ -135,6 +296,7 @@ public:
 
         mqtt* m_link { nullptr };
         std::string m_topic {};
+        publish_options_t m_options {};
     };
 
     /**
@@ -142,9 +304,10 @@ public:
      */
     class subscriber {
     public:
-        subscriber(mqtt* link, const std::string& topic)
+        subscriber(mqtt* link, const std::string& topic, QoS qos = QoS::AtLeastOnce)
             : m_link { link }
             , m_topic { topic }
+            , m_qos { qos }
         {
         }
 
@@ -155,8 +318,26 @@ public:
 
         subscriber() = default;
 
+        /**
+         * @brief emplace_callback Adds a callback which gets a copy of each line of each received message
+         * @param callback The callback to add
+         */
         void emplace_callback(std::function<void(const message_t&)> callback);
 
+        /**
+         * @brief emplace_view_callback Adds a callback which gets a view of each line of each received message.
+         * No data is copied for these callbacks.
+         * @param callback The callback to add
+         */
+        void emplace_view_callback(std::function<void(const message_view&)> callback);
+
+        /**
+         * @brief emplace_payload_callback Adds a callback which gets each received message as a whole.
+         * The payload is not split into lines, so this is the callback to use for binary payloads, see codec.h.
+         * @param callback The callback to add
+         */
+        void emplace_payload_callback(std::function<void(const message_view&)> callback);
+
         /**
          * @brief get_subscribe_topic Gets the topic the subscriber subscribes to
          * @return a std::string containing the subscribed topic
@@ -170,11 +351,25 @@ public:
          * @brief push_message Only called from within the mqtt class
          * @param message The message to push into the queue
          */
-        void push_message(const message_t& message);
+        void push_message(const message_view& message);
+
+        /**
+         * @brief push_payload Only called from within the mqtt class
+         * @param message The complete message
+         */
+        void push_payload(const message_view& message);
+
+        /**
+         * @brief wants_lines true if any callback gets single lines
+         */
+        [[nodiscard]] auto wants_lines() const -> bool;
 
         mqtt* m_link { nullptr };
         std::string m_topic {};
+        QoS m_qos { QoS::AtLeastOnce };
         std::vector<std::function<void(const message_t&)>> m_callback;
+        std::vector<std::function<void(const message_view&)>> m_view_callback;
+        std::vector<std::function<void(const message_view&)>> m_payload_callback;
     };
 
     /**
@@ -193,11 +388,20 @@ public:
      */
     [[nodiscard]] auto publish(const std::string& topic) -> publisher&;
 
+    /**
+     * @brief publish Create a publisher callback object
+     * @param topic The topic under which the publisher sends messages
+     * @param options How the messages are sent. Only used if there is no publisher for the topic yet.
+     */
+    [[nodiscard]] auto publish(const std::string& topic, publish_options_t options) -> publisher&;
+
     /**
      * @brief subscribe Create a subscriber callback object
      * @param topic The topic to subscribe to. See mqtt for wildcards.
+     * Shared subscriptions of the form '$share/<group>/<filter>' are supported.
+     * @param qos The maximum QoS the broker uses to deliver messages
      */
-    [[nodiscard]] auto subscribe(const std::string& topic) -> subscriber&;
+    [[nodiscard]] auto subscribe(const std::string& topic, QoS qos = QoS::AtLeastOnce) -> subscriber&;
 
     /**
      * @brief wait_for Wait for a designated time until the status changes to the one set as the parameter
@@ -206,6 +410,11 @@ public:
      */
     [[nodiscard]] auto wait_for(Status status, std::chrono::milliseconds duration = std::chrono::seconds { 5 }) -> bool;
 
+    /**
+     * @brief statistics The reconnect count and downtime of the connection
+     */
+    [[nodiscard]] auto statistics() const -> statistics_t;
+
 protected:
     /**
      * @brief pre_run Reimplemented from thread_runner
@@ -232,7 +441,51 @@ private:
      */
     void set_status(Status status);
 
-    [[nodiscard]] auto publish(const std::string& topic, const std::string& content) -> bool;
+    [[nodiscard]] auto publish(const std::string& topic, const std::string& content, const publish_options_t& options) -> bool;
+
+    /**
+     * @brief send Hands a message to mosquitto, using a topic alias if requested and available
+     * @return The mosquitto result code
+     */
+    [[nodiscard]] auto send(const std::string& topic, const std::string& content, const publish_options_t& options) -> int;
+
+    /**
+     * @brief enqueue Puts a message into the outbound queue and wakes the mqtt thread if necessary
+     * @return false if the queue is full
+     */
+    [[nodiscard]] auto enqueue(std::string topic, std::string content, const publish_options_t& options) -> bool;
+
+    /**
+     * @brief flush_outbound Drains the outbound queue, combines the messages per topic and publishes them.
+     * Only called from the mqtt thread.
+     */
+    void flush_outbound();
+
+    /**
+     * @brief wake Interrupts service, so the mqtt thread handles new work and packets queued by other threads
+     */
+    void wake();
+
+    /**
+     * @brief service Runs the network loop of mosquitto once. Waits until the socket is ready, wake was called,
+     * or the timeout elapsed, then reads and writes pending packets and sends keepalive pings.
+     * Callbacks of mosquitto are called from here. Only called from the mqtt thread.
+     * @param timeout The maximum time to wait
+     */
+    void service(std::chrono::microseconds timeout);
+
+    /**
+     * @brief service_until Runs the network loop until a condition is met or a deadline passed. Only called from the mqtt thread.
+     * @param deadline The time to give up
+     * @param done The condition, checked before every run of the loop
+     * @return true if the condition was met
+     */
+    [[nodiscard]] auto service_until(std::chrono::steady_clock::time_point deadline, const std::function<bool()>& done) -> bool;
+
+    /**
+     * @brief replay_spool Sends spooled messages, limited by the replay rate. Only called from the mqtt thread.
+     */
+    void replay_spool();
 
     /**
      * @brief unsubscribe Unsubscribe from a specific topic
@@ -242,10 +495,16 @@ private:
 
     /**
      * @brief connects to the Server synchronuously. This method blocks until it is connected.
-     * @return true if the connection was successful
+     * Failed attempts are repeated with an exponentially growing, jittered delay.
+     * @return false if the link gave up or was stopped
      */
     [[nodiscard]] auto connect() -> bool;
 
+    /**
+     * @brief backoff The delay before the next connection attempt
+     */
+    [[nodiscard]] auto backoff() -> std::chrono::milliseconds;
+
     /**
      * @brief disconnect Disconnect from the server
      * @return true if the disconnect was successful
@@ -254,7 +513,7 @@ private:
 
     [[nodiscard]] auto check_connection() -> bool;
 
-    auto p_subscribe(const std::string& topic) -> bool;
+    auto p_subscribe(const std::string& topic, QoS qos) -> bool;
 
     /**
      * @brief init Initialise the mosquitto object. This is necessary since the mosquitto_lib_init() needs to be called before mosquitto_new().
@@ -270,22 +529,65 @@ private:
     std::string m_station_id {};
     mosquitto* m_mqtt { nullptr };
 
-    Status m_status { Status::Invalid };
+    std::atomic<Status> m_status { Status::Invalid };
+    mutable std::mutex m_status_mutex {};
+    std::condition_variable m_status_condition {};
 
     std::map<std::string, std::unique_ptr<publisher>> m_publishers {};
     std::map<std::string, std::unique_ptr<subscriber>> m_subscribers {};
-
-    std::promise<bool> m_connect_promise {};
-    std::future<bool> m_connect_future {};
-    std::condition_variable m_connect_condition {};
+    topic_trie<subscriber*> m_subscription_trie {};
 
     std::size_t m_tries { 0 };
+    std::mt19937 m_random { std::random_device {}() };
+
+    std::size_t m_reconnects { 0 };
+    std::size_t m_attempts { 0 };
+    std::chrono::steady_clock::duration m_downtime { 0 };
+    std::optional<std::chrono::steady_clock::time_point> m_disconnected_since {};
+
+    struct outbound_message_t {
+        std::string topic {};
+        std::string content {};
+        publish_options_t options {};
+    };
+
+    struct batch_t {
+        std::string content {};
+        publish_options_t options {};
+    };
+
+    struct topic_alias_t {
+        std::uint16_t id { 0 };
+        bool established { false };
+    };
+
+    std::unique_ptr<lockfree_queue<outbound_message_t>> m_outbound { nullptr };
+    std::map<std::string, batch_t> m_outbound_batches {};
+    std::atomic<bool> m_outbound_signalled { false };
+    std::atomic<bool> m_reconnect { false };
+    /**
+     * @brief m_wakeup_fd An eventfd the network loop polls together with the socket, see wake
+     */
+    int m_wakeup_fd { -1 };
+    std::atomic<bool> m_wakeup_pending { false };
+
+    std::unique_ptr<spool> m_spool { nullptr };
+    std::chrono::steady_clock::time_point m_last_replay { std::chrono::steady_clock::now() };
+    double m_replay_tokens { 0.0 };
+
+    std::mutex m_alias_mutex {};
+    std::map<std::string, topic_alias_t, std::less<>> m_topic_aliases {};
+    /**
+     * @brief m_alias_maximum The number of topic aliases usable on the current connection
+     */
+    std::uint16_t m_alias_maximum { 0 };
 
     /**
      * @brief callback_connected Gets called by mosquitto client
      * @param result The status code from the callback
+     * @param alias_maximum The topic alias maximum of the broker
      */
-    void callback_connected(int result);
+    void callback_connected(int result, std::uint16_t alias_maximum);
 
     /**
      * @brief callback_disconnected Gets called by mosquitto client
@@ -307,6 +609,7 @@ private:
     [[nodiscard]] auto client_id() const -> std::string;
 
     friend void wrapper_callback_connected(mosquitto* mqtt, void* object, int result);
+    friend void wrapper_callback_connected_v5(mosquitto* mqtt, void* object, int result, int flags, const mosquitto_property* properties);
     friend void wrapper_callback_disconnected(mosquitto* mqtt, void* object, int result);
     friend void wrapper_callback_message(mosquitto* mqtt, void* object, const mosquitto_message* message);
 };
@@ -0,0 +1,151 @@
+#ifndef SHARDED_MQTT_H
+#define SHARDED_MQTT_H
+
+#include "muonpi/global.h"
+
+#include "muonpi/link/mqtt.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace muonpi::link {
+
+/**
+ * @brief The sharded_mqtt class. Spreads the traffic of one station over several mqtt connections,
+ * each with its own network thread.
+ * Every topic is published over the connection selected by the hash of the topic, so the order of the
+ * messages of one topic is kept. Subscriptions use mqtt shared subscriptions, so the broker hands each
+ * message to only one of the connections.
+ */
+class LIBMUONPI_PUBLIC sharded_mqtt {
+public:
+    struct configuration {
+        /**
+         * @brief link The configuration used for every connection. The client id suffix gets replaced per connection.
+         */
+        mqtt::configuration link {};
+        /**
+         * @brief shards The number of connections
+         */
+        std::size_t shards { 4 };
+        /**
+         * @brief share_group The group name of the shared subscriptions. An empty name uses the station id.
+         * Other clients using the same group share the messages as well.
+         */
+        std::string share_group {};
+    };
+
+    /**
+     * @brief The subscriber class. Bundles the subscribers of all connections for one topic.
+     * The callbacks get called from the network threads of all connections, possibly at the same time.
+     */
+    class subscriber {
+    public:
+        subscriber(std::string topic, std::vector<mqtt::subscriber*> subscribers);
+
+        /**
+         * @brief emplace_callback Adds a callback which gets a copy of each line of each received message
+         * @param callback The callback to add
+         */
+        void emplace_callback(const std::function<void(const mqtt::message_t&)>& callback);
+
+        /**
+         * @brief emplace_view_callback Adds a callback which gets a view of each line of each received message.
+         * @param callback The callback to add
+         */
+        void emplace_view_callback(const std::function<void(const mqtt::message_view&)>& callback);
+
+        /**
+         * @brief emplace_payload_callback Adds a callback which gets each received message as a whole.
+         * @param callback The callback to add
+         */
+        void emplace_payload_callback(const std::function<void(const mqtt::message_view&)>& callback);
+
+        /**
+         * @brief get_subscribe_topic Gets the topic the subscriber subscribes to, without the shared subscription prefix
+         */
+        [[nodiscard]] auto get_subscribe_topic() const -> const std::string&;
+
+    private:
+        std::string m_topic {};
+        std::vector<mqtt::subscriber*> m_subscribers {};
+    };
+
+    /**
+     * @brief sharded_mqtt Opens all connections
+     * @param config The configuration to use
+     * @param station_id The station id, the client ids of the connections are derived from it
+     * @param name The name of the connection threads
+     */
+    sharded_mqtt(configuration config, const std::string& station_id, const std::string& name = "muon::mqtt");
+
+    ~sharded_mqtt();
+
+    sharded_mqtt(const sharded_mqtt&) = delete;
+    sharded_mqtt(sharded_mqtt&&) = delete;
+    auto operator=(const sharded_mqtt&) -> sharded_mqtt& = delete;
+    auto operator=(sharded_mqtt&&) -> sharded_mqtt& = delete;
+
+    /**
+     * @brief publish Create a publisher callback object on the connection responsible for the topic
+     * @param topic The topic under which the publisher sends messages
+     */
+    [[nodiscard]] auto publish(const std::string& topic) -> mqtt::publisher&;
+
+    /**
+     * @brief publish Create a publisher callback object on the connection responsible for the topic
+     * @param topic The topic under which the publisher sends messages
+     * @param options How the messages are sent. Only used if there is no publisher for the topic yet.
+     */
+    [[nodiscard]] auto publish(const std::string& topic, mqtt::publish_options_t options) -> mqtt::publisher&;
+
+    /**
+     * @brief subscribe Subscribes to a topic on all connections
+     * @param topic The topic to subscribe to. See mqtt for wildcards.
+     * @param qos The maximum QoS the broker uses to deliver messages
+     */
+    [[nodiscard]] auto subscribe(const std::string& topic, mqtt::QoS qos = mqtt::QoS::AtLeastOnce) -> subscriber&;
+
+    /**
+     * @brief wait_for Wait until all connections have a status
+     * @param status The status to wait for
+     * @param duration The duration to wait for as a maximum
+     */
+    [[nodiscard]] auto wait_for(mqtt::Status status, std::chrono::milliseconds duration = std::chrono::seconds { 5 }) -> bool;
+
+    /**
+     * @brief stop Tells all connections to finish
+     */
+    void stop(int exit_code = 0);
+
+    /**
+     * @brief wait Wait for all connections to finish
+     * @return The first non zero return value of the connection threads
+     */
+    [[nodiscard]] auto wait() -> int;
+
+    /**
+     * @brief shard The connection responsible for a topic
+     */
+    [[nodiscard]] auto shard(const std::string& topic) -> mqtt&;
+
+    /**
+     * @brief size The number of connections
+     */
+    [[nodiscard]] auto size() const -> std::size_t;
+
+private:
+    configuration m_config {};
+    std::vector<std::unique_ptr<mqtt>> m_links {};
+    std::map<std::string, std::unique_ptr<subscriber>> m_subscribers {};
+    std::mutex m_mutex {};
+};
+
+}
+
+#endif // SHARDED_MQTT_H
@@ -0,0 +1,172 @@
+#ifndef MQTT_SPOOL_H
+#define MQTT_SPOOL_H
+
+#include "muonpi/global.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace muonpi::link {
+
+/**
+ * @brief The spool class. A durable first in, first out store for messages which could not be sent.
+ * Messages are appended to memory mapped segment files of a fixed size in a directory.
+ * Only the segment currently written and the one currently read are mapped, so the number of spooled
+ * messages is only bounded by the configured disk space. Fully read segments are deleted.
+ * The write and read positions are kept in the segment headers, so a spool survives restarts of the process.
+ */
+class LIBMUONPI_PUBLIC spool {
+public:
+    struct configuration {
+        /**
+         * @brief directory The directory for the segment files. It gets created if necessary.
+         */
+        std::string directory {};
+        std::size_t segment_bytes { 16 * 1024 * 1024 };
+        /**
+         * @brief max_segments The maximum number of segment files.
+         */
+        std::size_t max_segments { 64 };
+        /**
+         * @brief drop_oldest If the spool is full, the oldest segment is discarded to make space.
+         * Otherwise new messages are rejected.
+         */
+        bool drop_oldest { true };
+    };
+
+    /**
+     * @brief The options_t struct. The delivery options stored with each message, so it is replayed the way it was published.
+     */
+    struct options_t {
+        /**
+         * @brief qos The mqtt quality of service, 0 to 2
+         */
+        std::uint8_t qos { 1 };
+        bool retain { false };
+    };
+
+    /**
+     * @brief spool Opens a spool, continuing where a previous instance left off.
+     * Segments written in another format are renamed to '<name>.spool.rejected' and not replayed.
+     * @param config The configuration to use
+     * @throws std::runtime_error if the directory can not be used
+     */
+    explicit spool(configuration config);
+
+    ~spool();
+
+    spool(const spool&) = delete;
+    spool(spool&&) = delete;
+    auto operator=(const spool&) -> spool& = delete;
+    auto operator=(spool&&) -> spool& = delete;
+
+    /**
+     * @brief append Adds a message at the end of the spool
+     * @param options The delivery options to replay the message with
+     * @return false if the message was rejected, because it is larger than a segment or the spool is full
+     */
+    auto append(std::string_view topic, std::string_view content, options_t options) -> bool;
+
+    /**
+     * @brief append Adds a message with the default options at the end of the spool
+     */
+    auto append(std::string_view topic, std::string_view content) -> bool;
+
+    /**
+     * @brief replay Hands spooled messages to a function, oldest first.
+     * A message is only removed from the spool once the function returned true for it.
+     * The function gets a copy of the message and is called without holding the lock, so it may take its time.
+     * A segment with a record which does not fit into it is considered corrupted, its remaining messages are discarded.
+     * @param function Gets called with the topic, content and options of each message. Returns false to stop the replay.
+     * @param max_messages The maximum number of messages to replay in this call
+     * @return The number of messages which were removed from the spool
+     */
+    auto replay(const std::function<bool(std::string_view topic, std::string_view content, const options_t& options)>& function, std::size_t max_messages) -> std::size_t;
+
+    /**
+     * @brief size The number of messages in the spool
+     */
+    [[nodiscard]] auto size() const -> std::size_t;
+
+    [[nodiscard]] auto empty() const -> bool;
+
+    /**
+     * @brief dropped The number of messages discarded or rejected because the spool was full
+     */
+    [[nodiscard]] auto dropped() const -> std::size_t;
+
+    /**
+     * @brief sync Schedules the mapped segments to be written to disk
+     */
+    void sync();
+
+private:
+    struct header_t;
+
+    /**
+     * @brief The segment class. One memory mapped segment file.
+     */
+    class segment {
+    public:
+        segment(const std::string& path, std::size_t bytes, bool create);
+        ~segment();
+
+        segment(const segment&) = delete;
+        segment(segment&&) = delete;
+        auto operator=(const segment&) -> segment& = delete;
+        auto operator=(segment&&) -> segment& = delete;
+
+        [[nodiscard]] auto header() -> header_t&;
+        [[nodiscard]] auto data() -> char*;
+        [[nodiscard]] auto capacity() const -> std::size_t;
+        void sync();
+
+    private:
+        int m_fd { -1 };
+        char* m_memory { nullptr };
+        std::size_t m_bytes { 0 };
+    };
+
+    [[nodiscard]] auto path(std::uint64_t sequence) const -> std::string;
+
+    /**
+     * @brief open_write Starts a new segment for writing
+     * @return false if the spool is full and the oldest segment may not be dropped
+     */
+    [[nodiscard]] auto open_write() -> bool;
+
+    /**
+     * @brief remove_front Deletes the oldest segment
+     */
+    void remove_front();
+
+    /**
+     * @brief reader Maps the oldest segment for reading
+     */
+    [[nodiscard]] auto reader() -> segment*;
+
+    /**
+     * @brief peek Copies the oldest message without removing it. Deletes fully read segments on the way.
+     * @param sequence Gets set to the segment of the message
+     * @param offset Gets set to the offset of the message in its segment
+     * @return false if the spool is empty
+     */
+    [[nodiscard]] auto peek(std::string& topic, std::string& content, options_t& options, std::uint64_t& sequence, std::uint64_t& offset) -> bool;
+
+    configuration m_config {};
+    mutable std::mutex m_mutex {};
+    std::deque<std::uint64_t> m_segments {};
+    std::unique_ptr<segment> m_write { nullptr };
+    std::unique_ptr<segment> m_read { nullptr };
+    std::size_t m_size { 0 };
+    std::size_t m_dropped { 0 };
+};
+
+}
+
+#endif // MQTT_SPOOL_H
@@ -0,0 +1,256 @@
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include "muonpi/global.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace muonpi::link {
+
+/**
+ * @brief The topic_trie class. Matches mqtt topics against a set of subscription filters.
+ * Each level of a filter is one node of the trie, so matching a topic takes time proportional to its depth
+ * instead of the number of filters. Supports the single level wildcard '+' and the multi level wildcard '#'.
+ * As in mqtt, topics starting with '$' are not matched by wildcards in the first level.
+ * Every entry has a key, so several entries may share one filter. By default the key is the filter itself.
+ * @param T The type of the value stored for each filter
+ */
+template <typename T>
+class LIBMUONPI_PUBLIC topic_trie {
+public:
+    /**
+     * @brief insert Adds a filter, or replaces the value of an existing one
+     * @param filter The subscription filter
+     * @param value The value to store for the filter
+     */
+    void insert(std::string_view filter, T value);
+
+    /**
+     * @brief insert Adds an entry for a filter, or replaces the value of the entry with the same key
+     * @param filter The subscription filter
+     * @param key Identifies the entry among all entries of the filter
+     * @param value The value to store for the entry
+     */
+    void insert(std::string_view filter, std::string_view key, T value);
+
+    /**
+     * @brief erase Removes a filter. Nodes which are no longer needed are removed as well.
+     * @param filter The subscription filter
+     * @return true if the filter existed
+     */
+    auto erase(std::string_view filter) -> bool;
+
+    /**
+     * @brief erase Removes one entry of a filter. Nodes which are no longer needed are removed as well.
+     * @param filter The subscription filter
+     * @param key The key the entry was inserted with
+     * @return true if the entry existed
+     */
+    auto erase(std::string_view filter, std::string_view key) -> bool;
+
+    /**
+     * @brief match Calls a function for the value of every filter which matches a topic
+     * @param topic The topic of a message. It may not contain wildcards.
+     * @param function Gets called with a reference to each matching value
+     */
+    template <typename F>
+    void match(std::string_view topic, F&& function);
+
+    /**
+     * @brief empty true if no filter is stored
+     */
+    [[nodiscard]] auto empty() const -> bool;
+
+private:
+    using entries_t = std::map<std::string, T, std::less<>>;
+
+    struct node {
+        std::map<std::string, std::unique_ptr<node>, std::less<>> children {};
+        std::unique_ptr<node> single {};
+        entries_t multi {};
+        entries_t values {};
+
+        [[nodiscard]] inline auto empty() const -> bool
+        {
+            return children.empty() && (single == nullptr) && multi.empty() && values.empty();
+        }
+    };
+
+    /**
+     * @brief split Separates the first level of a topic
+     * @param topic The topic, gets set to the remaining levels
+     * @param last Gets set to true if this was the last level
+     * @return The first level
+     */
+    [[nodiscard]] static auto split(std::string_view& topic, bool& last) -> std::string_view;
+
+    template <typename F>
+    static void match(node& current, std::string_view topic, bool done, bool first, F& function);
+
+    static auto erase(node& current, std::string_view filter, std::string_view key) -> bool;
+
+    static auto erase(entries_t& entries, std::string_view key) -> bool;
+
+    node m_root {};
+};
+
+// +++++++++++++++++++++++++++++++
+// implementation part starts here
+// +++++++++++++++++++++++++++++++
+
+template <typename T>
+auto topic_trie<T>::split(std::string_view& topic, bool& last) -> std::string_view
+{
+    const auto separator { topic.find('/') };
+    if (separator == std::string_view::npos) {
+        const std::string_view level { topic };
+        topic = {};
+        last = true;
+        return level;
+    }
+    const std::string_view level { topic.substr(0, separator) };
+    topic.remove_prefix(separator + 1);
+    last = false;
+    return level;
+}
+
+template <typename T>
+void topic_trie<T>::insert(std::string_view filter, T value)
+{
+    insert(filter, filter, std::move(value));
+}
+
+template <typename T>
+void topic_trie<T>::insert(std::string_view filter, std::string_view key, T value)
+{
+    node* current { &m_root };
+    bool last { false };
+    while (!last) {
+        const std::string_view level { split(filter, last) };
+        if (level == "#") {
+            current->multi.insert_or_assign(std::string { key }, std::move(value));
+            return;
+        }
+        if (level == "+") {
+            if (current->single == nullptr) {
+                current->single = std::make_unique<node>();
+            }
+            current = current->single.get();
+            continue;
+        }
+        auto it { current->children.find(level) };
+        if (it == current->children.end()) {
+            it = current->children.emplace(std::string { level }, std::make_unique<node>()).first;
+        }
+        current = it->second.get();
+    }
+    current->values.insert_or_assign(std::string { key }, std::move(value));
+}
+
+template <typename T>
+auto topic_trie<T>::erase(std::string_view filter) -> bool
+{
+    return erase(m_root, filter, filter);
+}
+
+template <typename T>
+auto topic_trie<T>::erase(std::string_view filter, std::string_view key) -> bool
+{
+    return erase(m_root, filter, key);
+}
+
+template <typename T>
+auto topic_trie<T>::erase(entries_t& entries, std::string_view key) -> bool
+{
+    const auto it { entries.find(key) };
+    if (it == entries.end()) {
+        return false;
+    }
+    entries.erase(it);
+    return true;
+}
+
+template <typename T>
+auto topic_trie<T>::erase(node& current, std::string_view filter, std::string_view key) -> bool
+{
+    bool last { false };
+    const std::string_view level { split(filter, last) };
+    if (level == "#") {
+        return erase(current.multi, key);
+    }
+    node* next { nullptr };
+    typename decltype(current.children)::iterator it {};
+    if (level == "+") {
+        next = current.single.get();
+    } else {
+        it = current.children.find(level);
+        if (it != current.children.end()) {
+            next = it->second.get();
+        }
+    }
+    if (next == nullptr) {
+        return false;
+    }
+    bool existed { false };
+    if (last) {
+        existed = erase(next->values, key);
+    } else {
+        existed = erase(*next, filter, key);
+    }
+    if (next->empty()) {
+        if (level == "+") {
+            current.single.reset();
+        } else {
+            current.children.erase(it);
+        }
+    }
+    return existed;
+}
+
+template <typename T>
+template <typename F>
+void topic_trie<T>::match(std::string_view topic, F&& function)
+{
+    match(m_root, topic, false, true, function);
+}
+
+template <typename T>
+template <typename F>
+void topic_trie<T>::match(node& current, std::string_view topic, bool done, bool first, F& function)
+{
+    const bool wildcards { !first || topic.empty() || (topic.front() != '$') };
+    if (wildcards) {
+        // '#' also matches the parent level itself
+        for (auto& [key, value] : current.multi) {
+            function(value);
+        }
+    }
+    if (done) {
+        for (auto& [key, value] : current.values) {
+            function(value);
+        }
+        return;
+    }
+    bool last { false };
+    const std::string_view level { split(topic, last) };
+    const auto it { current.children.find(level) };
+    if (it != current.children.end()) {
+        match(*it->second, topic, last, false, function);
+    }
+    if (wildcards && (current.single != nullptr)) {
+        match(*current.single, topic, last, false, function);
+    }
+}
+
+template <typename T>
+auto topic_trie<T>::empty() const -> bool
+{
+    return m_root.empty();
+}
+
+}
+
+#endif // TOPIC_TRIE_H
@@ -0,0 +1,190 @@
+#ifndef LOCKFREE_QUEUE_H
+#define LOCKFREE_QUEUE_H
+
+#include "muonpi/global.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+
+namespace muonpi {
+
+/**
+ * @brief The lockfree_queue class. A bounded, lock free FIFO queue on a preallocated ring buffer.
+ * Any number of threads may push and pop concurrently. Each slot carries a sequence number
+ * which tells producers and consumers whether the slot is free or filled for the current lap.
+ * Items are moved in and out, T does not need to be copyable or default constructible.
+ * @param T The type of the stored items
+ */
+template <typename T>
+class LIBMUONPI_PUBLIC lockfree_queue {
+public:
+    /**
+     * @brief lockfree_queue
+     * @param capacity The number of slots. Gets rounded up to the next power of two.
+     */
+    explicit lockfree_queue(std::size_t capacity);
+
+    ~lockfree_queue();
+
+    lockfree_queue(const lockfree_queue&) = delete;
+    lockfree_queue(lockfree_queue&&) = delete;
+    auto operator=(const lockfree_queue&) -> lockfree_queue& = delete;
+    auto operator=(lockfree_queue&&) -> lockfree_queue& = delete;
+
+    /**
+     * @brief try_push Tries to move an item into the queue.
+     * @param item The item to push. It is only moved from if the push succeeded.
+     * @return false if the queue was full
+     */
+    [[nodiscard]] auto try_push(T&& item) -> bool;
+
+    /**
+     * @brief try_pop Tries to take the oldest item out of the queue.
+     * @return The item, or std::nullopt if the queue was empty
+     */
+    [[nodiscard]] auto try_pop() -> std::optional<T>;
+
+    /**
+     * @brief size The number of items currently in the queue.
+     * This is only a snapshot, it may already be outdated when it is returned.
+     */
+    [[nodiscard]] auto size() const -> std::size_t;
+
+    /**
+     * @brief empty true if there were no items in the queue. Same caveat as size() applies.
+     */
+    [[nodiscard]] auto empty() const -> bool;
+
+    /**
+     * @brief capacity The number of slots in the queue
+     */
+    [[nodiscard]] auto capacity() const -> std::size_t;
+
+private:
+    constexpr static std::size_t s_cacheline { 64 };
+
+    struct slot {
+        std::atomic<std::size_t> sequence { 0 };
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage {};
+
+        [[nodiscard]] inline auto item() -> T*
+        {
+            return std::launder(reinterpret_cast<T*>(&storage));
+        }
+    };
+
+    [[nodiscard]] static auto round_up(std::size_t capacity) -> std::size_t;
+
+    std::size_t m_mask {};
+    std::unique_ptr<slot[]> m_slots {};
+
+    alignas(s_cacheline) std::atomic<std::size_t> m_enqueue { 0 };
+    alignas(s_cacheline) std::atomic<std::size_t> m_dequeue { 0 };
+};
+
+// +++++++++++++++++++++++++++++++
+// implementation part starts here
+// +++++++++++++++++++++++++++++++
+
+template <typename T>
+lockfree_queue<T>::lockfree_queue(std::size_t capacity)
+    : m_mask { round_up(capacity) - 1 }
+    , m_slots { std::make_unique<slot[]>(m_mask + 1) }
+{
+    for (std::size_t i { 0 }; i <= m_mask; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+lockfree_queue<T>::~lockfree_queue()
+{
+    while (try_pop().has_value()) {
+    }
+}
+
+template <typename T>
+auto lockfree_queue<T>::round_up(std::size_t capacity) -> std::size_t
+{
+    std::size_t result { 2 };
+    while (result < capacity) {
+        result <<= 1U;
+    }
+    return result;
+}
+
+template <typename T>
+auto lockfree_queue<T>::try_push(T&& item) -> bool
+{
+    std::size_t position { m_enqueue.load(std::memory_order_relaxed) };
+    for (;;) {
+        slot& current { m_slots[position & m_mask] };
+        const std::size_t sequence { current.sequence.load(std::memory_order_acquire) };
+        const auto difference { static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position) };
+        if (difference == 0) {
+            if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                new (&current.storage) T { std::move(item) };
+                current.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = m_enqueue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+auto lockfree_queue<T>::try_pop() -> std::optional<T>
+{
+    std::size_t position { m_dequeue.load(std::memory_order_relaxed) };
+    for (;;) {
+        slot& current { m_slots[position & m_mask] };
+        const std::size_t sequence { current.sequence.load(std::memory_order_acquire) };
+        const auto difference { static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1) };
+        if (difference == 0) {
+            if (m_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                std::optional<T> result { std::move(*current.item()) };
+                current.item()->~T();
+                current.sequence.store(position + m_mask + 1, std::memory_order_release);
+                return result;
+            }
+        } else if (difference < 0) {
+            return std::nullopt;
+        } else {
+            position = m_dequeue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+auto lockfree_queue<T>::size() const -> std::size_t
+{
+    const std::size_t dequeue { m_dequeue.load(std::memory_order_relaxed) };
+    const std::size_t enqueue { m_enqueue.load(std::memory_order_relaxed) };
+    if (enqueue <= dequeue) {
+        return 0;
+    }
+    return enqueue - dequeue;
+}
+
+template <typename T>
+auto lockfree_queue<T>::empty() const -> bool
+{
+    return size() == 0;
+}
+
+template <typename T>
+auto lockfree_queue<T>::capacity() const -> std::size_t
+{
+    return m_mask + 1;
+}
+
+}
+
+#endif // LOCKFREE_QUEUE_H
@@ -0,0 +1,215 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "muonpi/global.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace muonpi::metrics {
+
+namespace detail {
+    constexpr std::size_t s_stripes { 8 };
+    constexpr std::size_t s_cacheline { 64 };
+
+    /**
+     * @brief stripe The stripe index of the calling thread. Threads get assigned stripes round robin,
+     * so concurrent writers mostly touch different cache lines.
+     */
+    [[nodiscard]] LIBMUONPI_PUBLIC auto stripe() -> std::size_t;
+}
+
+/**
+ * @brief The counter class. A monotonic counter which is split into per thread stripes.
+ * Adding only touches the stripe of the calling thread, the stripes are summed up when the value is read.
+ */
+class LIBMUONPI_PUBLIC counter {
+public:
+    inline void add(std::uint64_t n = 1)
+    {
+        m_stripes[detail::stripe()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto value() const -> std::uint64_t;
+
+private:
+    struct alignas(detail::s_cacheline) stripe_t {
+        std::atomic<std::uint64_t> value { 0 };
+    };
+
+    std::array<stripe_t, detail::s_stripes> m_stripes {};
+};
+
+/**
+ * @brief The high_water class. Remembers the highest value it has seen.
+ */
+class LIBMUONPI_PUBLIC high_water {
+public:
+    inline void update(std::uint64_t value)
+    {
+        std::uint64_t current { m_value.load(std::memory_order_relaxed) };
+        while ((value > current) && !m_value.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    [[nodiscard]] auto value() const -> std::uint64_t;
+
+private:
+    std::atomic<std::uint64_t> m_value { 0 };
+};
+
+/**
+ * @brief The latency class. A histogram of durations with power of two buckets in nanoseconds, split into per thread stripes.
+ * Quantiles are reported as the upper bound of the bucket they fall into, so they are accurate within a factor of two.
+ */
+class LIBMUONPI_PUBLIC latency {
+public:
+    constexpr static std::size_t s_buckets { 64 };
+
+    struct summary_t {
+        std::uint64_t count { 0 };
+        double mean { 0.0 }; ///< in microseconds
+        double p50 { 0.0 }; ///< in microseconds
+        double p90 { 0.0 }; ///< in microseconds
+        double p99 { 0.0 }; ///< in microseconds
+        double max { 0.0 }; ///< in microseconds
+    };
+
+    inline void add(std::chrono::nanoseconds duration)
+    {
+        const auto ns { static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(duration.count(), 0)) };
+        auto& current { m_stripes[detail::stripe()] };
+        current.buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        current.sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto summary() const -> summary_t;
+
+private:
+    [[nodiscard]] inline static auto bucket(std::uint64_t ns) -> std::size_t
+    {
+        return (ns == 0) ? 0 : static_cast<std::size_t>(s_buckets - static_cast<std::size_t>(__builtin_clzll(ns)) - 1);
+    }
+
+    struct alignas(detail::s_cacheline) stripe_t {
+        std::array<std::atomic<std::uint64_t>, s_buckets> buckets {};
+        std::atomic<std::uint64_t> sum { 0 };
+    };
+
+    std::array<stripe_t, detail::s_stripes> m_stripes {};
+};
+
+/**
+ * @brief The stage class. Collects the metrics of one stage of a processing chain.
+ * A stage registers itself with the registry on construction and removes itself on destruction.
+ */
+class LIBMUONPI_PUBLIC stage {
+public:
+    struct snapshot_t {
+        std::string name {};
+        std::uint64_t items_in { 0 };
+        std::uint64_t items_out { 0 };
+        std::uint64_t dropped { 0 };
+        std::uint64_t pending { 0 };
+        std::uint64_t high_water { 0 };
+        /**
+         * @brief taken When the snapshot was taken. Pass two snapshots to rate to get the throughput in between.
+         */
+        std::chrono::steady_clock::time_point taken {};
+        /**
+         * @brief queue_time One sample per batch, see stage::queue_time
+         */
+        latency::summary_t queue_time {};
+        latency::summary_t process_time {};
+    };
+
+    /**
+     * @brief stage
+     * @param name The name under which the stage is reported
+     * @param pending Reports the current number of pending items, may be empty
+     * @param dropped Reports the number of dropped items, may be empty
+     */
+    explicit stage(std::string name, std::function<std::uint64_t()> pending = {}, std::function<std::uint64_t()> dropped = {});
+
+    ~stage();
+
+    stage(const stage&) = delete;
+    stage(stage&&) = delete;
+    auto operator=(const stage&) -> stage& = delete;
+    auto operator=(stage&&) -> stage& = delete;
+
+    /**
+     * @brief snapshot Reads the current values. Does not change the stage, so any number of pollers may take snapshots.
+     */
+    [[nodiscard]] auto snapshot() const -> snapshot_t;
+
+    /**
+     * @brief rate The number of processed items per second between two snapshots of the same stage
+     * @param previous The earlier snapshot, kept by the caller
+     * @param current The later snapshot
+     */
+    [[nodiscard]] static auto rate(const snapshot_t& previous, const snapshot_t& current) -> double;
+
+    [[nodiscard]] auto name() const -> const std::string&;
+
+    counter items_in {};
+    counter items_out {};
+    high_water queue_depth {};
+    /**
+     * @brief queue_time How long items wait before they are processed.
+     * Threaded sinks record one sample per batch they take from their queue: the wait of the oldest item in it.
+     * The items behind it waited less, so the distribution describes batches, not items.
+     * With the lockfree backend, the oldest item of the next batch is not stamped, its push time is interpolated
+     * from the previous batch assuming evenly spaced arrivals.
+     */
+    latency queue_time {};
+    /**
+     * @brief process_time How long processing takes
+     */
+    latency process_time {};
+
+private:
+    std::string m_name {};
+    std::function<std::uint64_t()> m_pending {};
+    std::function<std::uint64_t()> m_dropped {};
+};
+
+/**
+ * @brief The registry class. Knows all stages of the process.
+ */
+class LIBMUONPI_PUBLIC registry {
+public:
+    /**
+     * @brief instance The process wide registry
+     */
+    [[nodiscard]] static auto instance() -> registry&;
+
+    void add(stage& entry);
+
+    void remove(stage& entry);
+
+    /**
+     * @brief snapshot Takes a snapshot of all registered stages
+     */
+    [[nodiscard]] auto snapshot() -> std::vector<stage::snapshot_t>;
+
+    /**
+     * @brief to_json A snapshot of all registered stages as JSON array
+     */
+    [[nodiscard]] auto to_json() -> std::string;
+
+private:
+    std::mutex m_mutex {};
+    std::vector<stage*> m_stages {};
+};
+
+}
+
+#endif // METRICS_H
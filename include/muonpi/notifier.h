@@ -0,0 +1,43 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include "muonpi/global.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace muonpi {
+
+/**
+ * @brief The notifier class. A futex based wakeup signal for a single waiting thread.
+ * Notifying is a single atomic exchange as long as nobody is sleeping, the kernel is only involved when the waiter actually sleeps.
+ * Notifications are not counted, multiple notifications before a wait collapse into one.
+ */
+class LIBMUONPI_PUBLIC notifier {
+public:
+    /**
+     * @brief notify Wakes the waiting thread, or lets the next call to wait_for return immediately.
+     */
+    void notify();
+
+    /**
+     * @brief wait_for Waits until notified or the timeout elapsed.
+     * @param timeout The maximum duration to wait
+     * @return true if the notifier was notified, false on timeout
+     */
+    [[nodiscard]] auto wait_for(std::chrono::microseconds timeout) -> bool;
+
+private:
+    enum State : std::uint32_t {
+        Idle = 0,
+        Notified = 1,
+        Sleeping = 2
+    };
+
+    std::atomic<std::uint32_t> m_state { Idle };
+};
+
+}
+
+#endif // NOTIFIER_H
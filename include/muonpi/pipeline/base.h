@@ -3,15 +3,50 @@
 
 #include "muonpi/global.h"
 
+#include "muonpi/metrics.h"
 #include "muonpi/sink/base.h"
 #include "muonpi/source/base.h"
 
+#include <chrono>
+#include <memory>
+#include <string>
+
 namespace muonpi::pipeline {
 
 template <typename T>
 class LIBMUONPI_PUBLIC base : public sink::base<T>, public source::base<T> {
 public:
     base(sink::base<T>& sink);
+
+    /**
+     * @brief base A pipeline stage which registers itself with the metrics registry.
+     * @param sink The sink to forward items to
+     * @param name The name under which the stage is reported
+     */
+    base(sink::base<T>& sink, const std::string& name);
+
+    /**
+     * @brief overloaded Reimplemented from sink::base. A pipeline stage is overloaded when its downstream sink is.
+     */
+    [[nodiscard]] auto overloaded() const -> bool override;
+
+    /**
+     * @brief stage_metrics The metrics of this stage. Subclasses may record their own timings in it.
+     * @return nullptr if the stage was constructed without a name
+     */
+    [[nodiscard]] auto stage_metrics() -> metrics::stage*;
+
+protected:
+    /**
+     * @brief put Reimplemented from source::base. Counts the forwarded items
+     * and records how long the downstream sink took to accept them as process time.
+     * @param item The item to push
+     * @return false if the sink is overloaded and the producer should shed load
+     */
+    auto put(T item) -> bool;
+
+private:
+    std::unique_ptr<metrics::stage> m_metrics { nullptr };
 };
 
 template <typename T>
@@ -20,6 +55,39 @@ base<T>::base(sink::base<T>& sink)
 {
 }
 
+template <typename T>
+base<T>::base(sink::base<T>& sink, const std::string& name)
+    : source::base<T>(sink)
+    , m_metrics { std::make_unique<metrics::stage>(name) }
+{
+}
+
+template <typename T>
+auto base<T>::stage_metrics() -> metrics::stage*
+{
+    return m_metrics.get();
+}
+
+template <typename T>
+auto base<T>::put(T item) -> bool
+{
+    if (m_metrics == nullptr) {
+        return source::base<T>::put(std::move(item));
+    }
+    m_metrics->items_in.add();
+    const auto start { std::chrono::steady_clock::now() };
+    const bool result { source::base<T>::put(std::move(item)) };
+    m_metrics->process_time.add(std::chrono::steady_clock::now() - start);
+    m_metrics->items_out.add();
+    return result;
+}
+
+template <typename T>
+auto base<T>::overloaded() const -> bool
+{
+    return source::base<T>::sink_overloaded();
+}
+
 }
 
 #endif // PIPELINE_H
@@ -0,0 +1,365 @@
+#ifndef PIPELINE_TRANSFORM_H
+#define PIPELINE_TRANSFORM_H
+
+#include "muonpi/global.h"
+
+#include "muonpi/sink/base.h"
+
+#include <iterator>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace muonpi::pipeline {
+
+namespace detail {
+
+    /**
+     * @brief The node struct. Common base of all objects a chain owns.
+     */
+    struct LIBMUONPI_PUBLIC node {
+        virtual ~node() = default;
+    };
+
+    using nodes_t = std::vector<std::unique_ptr<node>>;
+
+    struct identity {
+        template <typename V, typename E>
+        inline void operator()(V&& value, E&& emit)
+        {
+            emit(std::forward<V>(value));
+        }
+    };
+
+    template <typename P, typename G>
+    struct map_stage {
+        P previous;
+        G function;
+
+        template <typename V, typename E>
+        inline void operator()(V&& value, E&& emit)
+        {
+            previous(std::forward<V>(value), [this, &emit](auto&& item) { emit(function(std::forward<decltype(item)>(item))); });
+        }
+    };
+
+    template <typename P, typename G>
+    struct filter_stage {
+        P previous;
+        G predicate;
+
+        template <typename V, typename E>
+        inline void operator()(V&& value, E&& emit)
+        {
+            previous(std::forward<V>(value), [this, &emit](auto&& item) {
+                if (predicate(std::as_const(item))) {
+                    emit(std::forward<decltype(item)>(item));
+                }
+            });
+        }
+    };
+
+    template <typename P, typename G>
+    struct flat_map_stage {
+        P previous;
+        G function;
+
+        template <typename V, typename E>
+        inline void operator()(V&& value, E&& emit)
+        {
+            previous(std::forward<V>(value), [this, &emit](auto&& item) {
+                auto range { function(std::forward<decltype(item)>(item)) };
+                for (auto& element : range) {
+                    emit(std::move(element));
+                }
+            });
+        }
+    };
+
+    /**
+     * @brief The fused class. Runs all synchronous stages of one segment as a single inlined call chain.
+     */
+    template <typename In, typename Out, typename F>
+    class fused : public sink::base<In>, public node {
+    public:
+        fused(F function, sink::base<Out>& next)
+            : m_function { std::move(function) }
+            , m_next { next }
+        {
+        }
+
+        void get(In item) override
+        {
+            m_function(std::move(item), [this](auto&& out) { m_next.get(std::forward<decltype(out)>(out)); });
+        }
+
+        [[nodiscard]] auto overloaded() const -> bool override
+        {
+            return m_next.overloaded();
+        }
+
+    private:
+        F m_function;
+        sink::base<Out>& m_next;
+    };
+
+    /**
+     * @brief The hop class. A queue and thread between two segments.
+     */
+    template <typename T>
+    class hop : public sink::threaded<T>, public node {
+    public:
+        hop(sink::base<T>& next, const std::string& name, sink::threaded_configuration config)
+            : sink::threaded<T> { name, config }
+            , m_next { next }
+        {
+        }
+
+        ~hop() override
+        {
+            this->finish();
+        }
+
+        void get(T item) override
+        {
+            this->internal_get(std::move(item));
+        }
+
+    protected:
+        [[nodiscard]] auto process(T item) -> int override
+        {
+            m_next.get(std::move(item));
+            return 0;
+        }
+
+    private:
+        sink::base<T>& m_next;
+    };
+
+    struct root {
+        template <typename T>
+        inline auto operator()(sink::base<T>& entry, nodes_t& /*nodes*/) -> sink::base<T>&
+        {
+            return entry;
+        }
+    };
+}
+
+/**
+ * @brief The chain class. A finished transform chain. Items pushed into it run through all stages
+ * and end up in the sink given to builder::into.
+ * Destroying the chain stops all hops, items still queued in them are discarded.
+ * @param In The type of the items the chain accepts
+ */
+template <typename In>
+class LIBMUONPI_PUBLIC chain : public sink::base<In> {
+public:
+    chain(sink::base<In>& entry, detail::nodes_t nodes);
+
+    ~chain() override;
+
+    chain(chain&&) noexcept = default;
+    chain(const chain&) = delete;
+    auto operator=(chain&&) -> chain& = delete;
+    auto operator=(const chain&) -> chain& = delete;
+
+    void get(In item) override;
+
+    void get_shared(std::shared_ptr<const In> item) override;
+
+    [[nodiscard]] auto overloaded() const -> bool override;
+
+private:
+    sink::base<In>* m_entry { nullptr };
+    detail::nodes_t m_nodes {};
+};
+
+/**
+ * @brief The builder class. Composes typed transformation stages.
+ * Consecutive map, filter and flat_map stages are fused at compile time into a single call chain
+ * without virtual calls or queues between them. A queue and thread are only inserted where hop is called.
+ *
+ * @code
+ * auto chain { pipeline::transform<std::string>()
+ *     .filter([](const std::string& line) { return !line.empty(); })
+ *     .map([](std::string line) { return parse(line); })
+ *     .hop("muon::parse")
+ *     .flat_map([](event e) { return e.hits(); })
+ *     .into(hit_sink) };
+ * @endcode
+ *
+ * @param Head The type of the items the finished chain accepts
+ * @param In The input type of the current segment
+ * @param Out The output type of the last stage
+ * @param F The fused stages of the current segment
+ * @param Upstream Builds the segments before the current one
+ */
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+class LIBMUONPI_PUBLIC builder {
+public:
+    builder(F function, Upstream upstream);
+
+    /**
+     * @brief map Transforms each item
+     * @param function Gets called with each item as rvalue, returns the transformed item
+     */
+    template <typename G>
+    [[nodiscard]] auto map(G function) &&;
+
+    /**
+     * @brief filter Only passes on items for which the predicate is true
+     * @param predicate Gets called with a const reference to each item
+     */
+    template <typename G>
+    [[nodiscard]] auto filter(G predicate) &&;
+
+    /**
+     * @brief flat_map Transforms each item into any number of items
+     * @param function Gets called with each item as rvalue, returns an iterable range of items which are moved on
+     */
+    template <typename G>
+    [[nodiscard]] auto flat_map(G function) &&;
+
+    /**
+     * @brief convert Converts each item to another type with static_cast
+     */
+    template <typename To>
+    [[nodiscard]] auto convert() &&;
+
+    /**
+     * @brief hop Inserts a queue and a thread. The stages after the hop run on that thread.
+     * @param name The name of the thread
+     * @param config The configuration of the queue
+     */
+    [[nodiscard]] auto hop(const std::string& name = "muon::hop", sink::threaded_configuration config = {}) &&;
+
+    /**
+     * @brief into Finishes the chain
+     * @param sink The sink which gets the output of the last stage. It has to outlive the chain.
+     */
+    [[nodiscard]] auto into(sink::base<Out>& sink) && -> chain<Head>;
+
+private:
+    F m_function;
+    Upstream m_upstream;
+};
+
+/**
+ * @brief transform Starts a transform chain
+ * @param T The type of the items the chain accepts
+ */
+template <typename T>
+[[nodiscard]] auto transform() -> builder<T, T, T, detail::identity, detail::root>
+{
+    return builder<T, T, T, detail::identity, detail::root> { detail::identity {}, detail::root {} };
+}
+
+// +++++++++++++++++++++++++++++++
+// implementation part starts here
+// +++++++++++++++++++++++++++++++
+
+template <typename In>
+chain<In>::chain(sink::base<In>& entry, detail::nodes_t nodes)
+    : m_entry { &entry }
+    , m_nodes { std::move(nodes) }
+{
+}
+
+template <typename In>
+chain<In>::~chain()
+{
+    // nodes are stored downstream first, so upstream hops stop before their targets go away
+    while (!m_nodes.empty()) {
+        m_nodes.pop_back();
+    }
+}
+
+template <typename In>
+void chain<In>::get(In item)
+{
+    m_entry->get(std::move(item));
+}
+
+template <typename In>
+void chain<In>::get_shared(std::shared_ptr<const In> item)
+{
+    m_entry->get_shared(std::move(item));
+}
+
+template <typename In>
+auto chain<In>::overloaded() const -> bool
+{
+    return m_entry->overloaded();
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+builder<Head, In, Out, F, Upstream>::builder(F function, Upstream upstream)
+    : m_function { std::move(function) }
+    , m_upstream { std::move(upstream) }
+{
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+template <typename G>
+auto builder<Head, In, Out, F, Upstream>::map(G function) &&
+{
+    using next_t = std::decay_t<std::invoke_result_t<G&, Out&&>>;
+    using stage_t = detail::map_stage<F, G>;
+    return builder<Head, In, next_t, stage_t, Upstream> { stage_t { std::move(m_function), std::move(function) }, std::move(m_upstream) };
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+template <typename G>
+auto builder<Head, In, Out, F, Upstream>::filter(G predicate) &&
+{
+    using stage_t = detail::filter_stage<F, G>;
+    return builder<Head, In, Out, stage_t, Upstream> { stage_t { std::move(m_function), std::move(predicate) }, std::move(m_upstream) };
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+template <typename G>
+auto builder<Head, In, Out, F, Upstream>::flat_map(G function) &&
+{
+    using range_t = std::decay_t<std::invoke_result_t<G&, Out&&>>;
+    using next_t = std::decay_t<decltype(*std::begin(std::declval<range_t&>()))>;
+    using stage_t = detail::flat_map_stage<F, G>;
+    return builder<Head, In, next_t, stage_t, Upstream> { stage_t { std::move(m_function), std::move(function) }, std::move(m_upstream) };
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+template <typename To>
+auto builder<Head, In, Out, F, Upstream>::convert() &&
+{
+    return std::move(*this).map([](Out&& item) { return static_cast<To>(std::move(item)); });
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+auto builder<Head, In, Out, F, Upstream>::hop(const std::string& name, sink::threaded_configuration config) &&
+{
+    auto upstream { [function = std::move(m_function), previous = std::move(m_upstream), name, config](sink::base<Out>& next, detail::nodes_t& nodes) mutable -> sink::base<Head>& {
+        auto queue { std::make_unique<detail::hop<Out>>(next, name, config) };
+        auto segment { std::make_unique<detail::fused<In, Out, F>>(std::move(function), *queue) };
+        sink::base<In>& entry { *segment };
+        nodes.emplace_back(std::move(queue));
+        nodes.emplace_back(std::move(segment));
+        return previous(entry, nodes);
+    } };
+    return builder<Head, Out, Out, detail::identity, decltype(upstream)> { detail::identity {}, std::move(upstream) };
+}
+
+template <typename Head, typename In, typename Out, typename F, typename Upstream>
+auto builder<Head, In, Out, F, Upstream>::into(sink::base<Out>& sink) && -> chain<Head>
+{
+    detail::nodes_t nodes {};
+    auto segment { std::make_unique<detail::fused<In, Out, F>>(std::move(m_function), sink) };
+    sink::base<In>& entry { *segment };
+    nodes.emplace_back(std::move(segment));
+    sink::base<Head>& head { m_upstream(entry, nodes) };
+    return chain<Head> { head, std::move(nodes) };
+}
+
+}
+
+#endif // PIPELINE_TRANSFORM_H
@@ -0,0 +1,105 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "muonpi/global.h"
+
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace muonpi {
+
+/**
+ * @brief The thread_placement struct. Describes where and how a thread is scheduled.
+ * All fields are optional, an empty placement leaves the thread as it was created.
+ */
+struct LIBMUONPI_PUBLIC thread_placement {
+    enum class Policy {
+        Other, ///< SCHED_OTHER, the default time sharing policy
+        Fifo, ///< SCHED_FIFO, real time without time slices
+        RoundRobin, ///< SCHED_RR, real time with time slices
+        Batch, ///< SCHED_BATCH, for throughput oriented threads
+        Idle ///< SCHED_IDLE, only runs when nothing else wants to
+    };
+
+    /**
+     * @brief cpus The cpus the thread may run on. Empty allows all cpus.
+     */
+    std::vector<int> cpus {};
+    std::optional<Policy> policy {};
+    /**
+     * @brief priority The real time priority. Only used with the Fifo and RoundRobin policies.
+     */
+    int priority { 0 };
+    /**
+     * @brief nice The nice level of the thread. Only used with the Other and Batch policies.
+     */
+    std::optional<int> nice {};
+    /**
+     * @brief numa_node The NUMA node the thread prefers to allocate memory from. -1 leaves the memory policy alone.
+     */
+    int numa_node { -1 };
+
+    /**
+     * @brief from_string Parses a placement from a configuration string.
+     * The string consists of whitespace or semicolon separated key=value pairs, e.g.
+     * "cpus=2,4-5 policy=fifo priority=50 numa=0" or "policy=other nice=-5".
+     * @throws std::runtime_error if the string could not be parsed
+     */
+    [[nodiscard]] static auto from_string(const std::string& config) -> thread_placement;
+
+    /**
+     * @brief current The effective placement of the calling thread, as reported by the kernel.
+     */
+    [[nodiscard]] static auto current() -> thread_placement;
+
+    /**
+     * @brief to_string The placement in the format accepted by from_string
+     */
+    [[nodiscard]] auto to_string() const -> std::string;
+
+    /**
+     * @brief empty true if the placement does not change anything
+     */
+    [[nodiscard]] auto empty() const -> bool;
+
+    /**
+     * @brief apply Applies the placement to the calling thread.
+     * Parts which fail, usually due to missing privileges, are logged and skipped.
+     * @return true if every part could be applied
+     */
+    auto apply() const -> bool;
+};
+
+/**
+ * @brief The numa_scope class. While an instance exists, memory allocated by the calling thread
+ * preferably comes from the given NUMA node. The previous memory policy is restored on destruction.
+ * Pages are placed when they are first touched, so buffers need to be initialised within the scope.
+ */
+class LIBMUONPI_PUBLIC numa_scope {
+public:
+    /**
+     * @brief numa_scope
+     * @param node The node to prefer. A negative node makes this a no-op.
+     */
+    explicit numa_scope(int node);
+
+    ~numa_scope();
+
+    numa_scope(const numa_scope&) = delete;
+    numa_scope(numa_scope&&) = delete;
+    auto operator=(const numa_scope&) -> numa_scope& = delete;
+    auto operator=(numa_scope&&) -> numa_scope& = delete;
+
+private:
+    constexpr static std::size_t s_mask_words { 16 };
+
+    bool m_active { false };
+    int m_mode { 0 };
+    std::array<unsigned long, s_mask_words> m_mask {};
+};
+
+}
+
+#endif // PLACEMENT_H
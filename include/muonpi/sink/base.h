@@ -3,11 +3,24 @@
 
 #include "muonpi/global.h"
 
+#include "muonpi/executor.h"
+#include "muonpi/lockfree_queue.h"
+#include "muonpi/metrics.h"
+#include "muonpi/notifier.h"
+#include "muonpi/placement.h"
+#include "muonpi/span.h"
 #include "muonpi/threadrunner.h"
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
+#include <thread>
+#include <vector>
 
 namespace muonpi::sink {
 
@@ -28,11 +41,100 @@ public:
      * @param item The item to push
      */
     virtual void get(T item) = 0;
+
+    /**
+     * @brief get_shared pushes an item which is shared with other sinks and must not be modified.
+     * Used by collection to fan out one item to several queued sinks without copying it per sink.
+     * Sinks which only read their items should override this to keep the handle instead of a copy,
+     * the default implementation passes a copy of the item to get.
+     * @param item The shared item
+     */
+    virtual void get_shared(std::shared_ptr<const T> item);
+
+    /**
+     * @brief overloaded Indicates that the sink can currently not keep up with the incoming items.
+     * Producers may use this to shed load before the sink starts dropping or blocking.
+     * @return true if the sink is overloaded. The default implementation never is.
+     */
+    [[nodiscard]] virtual auto overloaded() const -> bool;
+};
+
+/**
+ * @brief The threaded_configuration struct. Controls the item queue of a threaded sink.
+ */
+struct LIBMUONPI_PUBLIC threaded_configuration {
+    enum class backend_t {
+        mutex, ///< A std::vector guarded by a mutex, drained in one swap
+        lockfree ///< A preallocated lock free ring buffer
+    };
+
+    /**
+     * @brief The overflow_t enum. What happens to a new item when the queue is full.
+     */
+    enum class overflow_t {
+        block, ///< The producer waits until there is space again
+        drop_newest, ///< The new item is discarded
+        drop_oldest, ///< The oldest pending item is discarded to make space
+        sample ///< Only every sample_every-th new item is kept, evicting the oldest pending item
+    };
+
+    /**
+     * @brief timeout The timeout for how long the thread should wait before calling the process method without parameter.
+     */
+    std::chrono::milliseconds timeout { std::chrono::seconds { 5 } };
+    backend_t backend { backend_t::mutex };
+    /**
+     * @brief capacity The maximum number of pending items. Zero means unbounded for the mutex backend,
+     * the lockfree backend then uses 4096 slots. The lockfree backend rounds up to a power of two.
+     */
+    std::size_t capacity { 0 };
+    overflow_t overflow { overflow_t::block };
+    /**
+     * @brief sample_every The sampling ratio for the sample overflow policy.
+     */
+    std::size_t sample_every { 10 };
+    /**
+     * @brief max_batch The maximum number of items handed to a single process_batch call.
+     */
+    std::size_t max_batch { 10 };
+    /**
+     * @brief batch_latency How long the thread may wait for a batch to fill up to max_batch items
+     * once the first item arrived. Zero processes whatever is available immediately.
+     */
+    std::chrono::microseconds batch_latency { 0 };
+    /**
+     * @brief exec If set, the sink runs as cooperative tasks on this executor instead of its own thread.
+     * batch_latency is ignored in that case.
+     */
+    executor* exec { nullptr };
+    executor::Priority priority { executor::Priority::Normal };
+    /**
+     * @brief worker The executor worker the sink is pinned to, -1 lets any worker run it.
+     */
+    int worker { -1 };
+    /**
+     * @brief placement Where the thread of the sink is scheduled. Ignored when running on an executor.
+     * If a NUMA node is given, the ring of the lockfree backend is allocated on that node as well.
+     */
+    thread_placement placement {};
+    /**
+     * @brief metrics Registers the sink with the metrics registry under its name.
+     * Adds a timestamp read per produced batch and two per processed batch.
+     * The queue time is sampled once per batch, from the oldest item in it, see metrics::stage::queue_time.
+     */
+    bool metrics { false };
 };
 
 template <typename T>
 class LIBMUONPI_PUBLIC threaded : public base<T>, public thread_runner {
 public:
+    /**
+     * @brief threaded
+     * @param name The name of the thread. Useful for identification.
+     * @param config The configuration of the item queue.
+     */
+    threaded(const std::string& name, threaded_configuration config);
+
     /**
      * @brief threaded
      * @param name The name of the thread. Useful for identification.
@@ -48,6 +150,27 @@ public:
 
     virtual ~threaded() override;
 
+    /**
+     * @brief overloaded Reimplemented from base. True while the queue is at its capacity.
+     */
+    [[nodiscard]] auto overloaded() const -> bool override;
+
+    /**
+     * @brief dropped The number of items discarded due to the overflow policy
+     */
+    [[nodiscard]] auto dropped() const -> std::size_t;
+
+    /**
+     * @brief pending The number of items currently waiting in the queue
+     */
+    [[nodiscard]] auto pending() const -> std::size_t;
+
+    /**
+     * @brief stage_metrics The metrics of this sink
+     * @return nullptr if metrics are disabled in the configuration
+     */
+    [[nodiscard]] auto stage_metrics() -> metrics::stage*;
+
 protected:
     /**
      * @brief internal_get
@@ -59,7 +182,8 @@ protected:
      * @brief step Reimplemented from thread_runner.
      * Internally this uses the timeout given in the constructor, default is 5 seconds.
      * It waits for a maximum of timeout, if there is no item available,
-     * it calls the process method without parameter, if yes it calls the overloaded process method with the item as parameter.
+     * it calls the process method without parameter, if yes it takes all pending items at once
+     * and hands up to max_batch of them to process_batch.
      * @return the return code of the process methods. If it is nonzero, the Thread will finish.
      */
     [[nodiscard]] auto step() -> int override;
@@ -70,17 +194,70 @@ protected:
      * @return The status code which is passed along by the step method.
      */
     [[nodiscard]] virtual auto process(T item) -> int = 0;
+
+    /**
+     * @brief process_batch Gets called with a contiguous range of available items.
+     * The default implementation moves each item into process(T). Items may be moved from.
+     * @param items The next available items, in the order they were pushed
+     * @return The status code which is passed along by the step method.
+     */
+    [[nodiscard]] virtual auto process_batch(span<T> items) -> int;
     /**
      * @brief process Gets called periodically whenever there is an item available.
      * @return The status code which is passed along by the step method.
      */
     [[nodiscard]] virtual auto process() -> int;
 
+    /**
+     * @brief on_stop Reimplemented from thread_runner. Wakes the waiting thread.
+     * Subclasses which override this need to call it.
+     */
+    void on_stop() override;
+
 private:
-    std::chrono::milliseconds m_timeout { std::chrono::seconds { 5 } };
-    std::queue<T> m_items {};
+    /**
+     * @brief fill_batch Moves the pending items into the local batch buffer
+     */
+    void fill_batch();
+
+    /**
+     * @brief linger Waits until max_batch items are pending or batch_latency elapsed
+     */
+    void linger();
+
+    [[nodiscard]] auto push_locked(T&& item) -> bool;
+    [[nodiscard]] auto push_lockfree(T&& item) -> bool;
+
+    /**
+     * @brief keep_overflow Decides whether an item arriving at a full queue is kept, according to the overflow policy.
+     * Counts the item as dropped if not.
+     */
+    [[nodiscard]] auto keep_overflow() -> bool;
+
+    constexpr static std::size_t s_default_capacity { 4096 };
+    constexpr static std::size_t s_full_spins { 16 };
+    constexpr static std::chrono::microseconds s_full_backoff { 100 };
+
+    threaded_configuration m_config {};
+    std::vector<T> m_items {};
+    std::size_t m_head { 0 };
+    std::atomic<std::size_t> m_pending { 0 };
     std::mutex m_mutex {};
-    std::condition_variable m_has_items {};
+    std::condition_variable m_not_full {};
+    std::unique_ptr<lockfree_queue<T>> m_ring { nullptr };
+    notifier m_notifier {};
+
+    std::atomic<std::size_t> m_dropped { 0 };
+    std::atomic<std::size_t> m_overflows { 0 };
+
+    std::vector<T> m_batch {};
+    std::size_t m_batch_position { 0 };
+
+    /**
+     * @brief m_first_enqueue The time the oldest not yet drained item was pushed, zero if there is none.
+     */
+    std::atomic<std::chrono::steady_clock::rep> m_first_enqueue { 0 };
+    std::unique_ptr<metrics::stage> m_metrics { nullptr };
 };
 
 template <typename T>
@@ -91,14 +268,39 @@ public:
      * @param sinks The sinks where the items should be distributed
      */
     collection(std::vector<base<T>*> sinks, const std::string& name = "muon::sink");
+
+    /**
+     * @brief collection A collection of multiple sinks, each fed from its own queue and thread.
+     * @param sinks The sinks where the items should be distributed
+     * @param queue The configuration of the per sink queues. @see emplace(base<T>&, threaded_configuration)
+     */
+    collection(std::vector<base<T>*> sinks, threaded_configuration queue, const std::string& name = "muon::sink");
     collection(const std::string& name = "muon::sink");
 
+    /**
+     * @brief ~collection Stops the distribution thread and all per sink threads.
+     */
     ~collection() override;
 
     void get(T item) override;
 
+    /**
+     * @brief emplace Adds a sink which gets the items directly from the distribution thread.
+     * @param sink The sink to add
+     */
     void emplace(base<T>& sink);
 
+    /**
+     * @brief emplace Adds a sink which gets the items through its own queue and thread,
+     * so a slow sink does not delay the others. All queued sinks share one reference counted
+     * instance of each item, which gets handed to them through base::get_shared.
+     * If a queued sink is the only sink of the collection, it gets the items moved into base::get instead.
+     * Use a non blocking overflow policy to fully decouple the sink from the collection.
+     * @param sink The sink to add
+     * @param queue The configuration of the queue in front of the sink
+     */
+    void emplace(base<T>& sink, threaded_configuration queue);
+
 protected:
     /**
      * @brief get Reimplemented from threaded<T>. gets called when a new item is available
@@ -117,25 +319,85 @@ private:
         }
     };
 
+    /**
+     * @brief The shared_t struct. An item on its way to a queued sink.
+     * Either shared is set, if the item goes to several sinks, or owned, if the sink is the only receiver.
+     */
+    struct shared_t {
+        std::shared_ptr<const T> shared {};
+        std::shared_ptr<T> owned {};
+    };
+
+    /**
+     * @brief The queued_forward class. Hands shared items to a sink from a dedicated thread.
+     */
+    class queued_forward : public threaded<shared_t> {
+    public:
+        queued_forward(base<T>& sink, threaded_configuration queue);
+
+        ~queued_forward() override;
+
+        void get(shared_t item) override;
+
+    protected:
+        [[nodiscard]] auto process(shared_t item) -> int override;
+
+    private:
+        base<T>& m_sink;
+    };
+
     std::vector<forward> m_sinks {};
+    std::vector<std::unique_ptr<queued_forward>> m_queued {};
 };
 
 template <typename T>
 base<T>::~base() = default;
 
 template <typename T>
-threaded<T>::threaded(const std::string& name)
+void base<T>::get_shared(std::shared_ptr<const T> item)
+{
+    get(*item);
+}
+
+template <typename T>
+auto base<T>::overloaded() const -> bool
+{
+    return false;
+}
+
+template <typename T>
+threaded<T>::threaded(const std::string& name, threaded_configuration config)
     : thread_runner { name }
+    , m_config { config }
+{
+    m_config.max_batch = std::max<std::size_t>(m_config.max_batch, 1);
+    m_config.sample_every = std::max<std::size_t>(m_config.sample_every, 1);
+    if (m_config.backend == threaded_configuration::backend_t::lockfree) {
+        const numa_scope scope { m_config.placement.numa_node };
+        m_ring = std::make_unique<lockfree_queue<T>>((m_config.capacity == 0) ? s_default_capacity : m_config.capacity);
+    }
+    set_placement(m_config.placement);
+    if (m_config.metrics) {
+        m_metrics = std::make_unique<metrics::stage>(
+            name, [this] { return pending(); }, [this] { return dropped(); });
+    }
+    if (m_config.exec != nullptr) {
+        start(*m_config.exec, m_config.priority, m_config.worker);
+    } else {
+        start();
+    }
+}
+
+template <typename T>
+threaded<T>::threaded(const std::string& name)
+    : threaded<T> { name, threaded_configuration {} }
 {
-    start();
 }
 
 template <typename T>
 threaded<T>::threaded(const std::string& name, std::chrono::milliseconds timeout)
-    : thread_runner { name }
-    , m_timeout { timeout }
+    : threaded<T> { name, threaded_configuration { timeout } }
 {
-    start();
 }
 
 template <typename T>
@@ -144,44 +406,242 @@ threaded<T>::~threaded() = default;
 template <typename T>
 void threaded<T>::internal_get(T item)
 {
-    std::scoped_lock<std::mutex> lock { m_mutex };
-    m_items.push(item);
-    m_condition.notify_all();
+    // only the first item after a drain gets stamped, and only once it is in the queue
+    const bool stamp { (m_metrics != nullptr) && (m_first_enqueue.load(std::memory_order_relaxed) == 0) };
+    const auto now { stamp ? std::chrono::steady_clock::now().time_since_epoch().count() : std::chrono::steady_clock::rep { 0 } };
+    const bool pushed { (m_ring != nullptr) ? push_lockfree(std::move(item)) : push_locked(std::move(item)) };
+    if (!pushed) {
+        return;
+    }
+    if (m_metrics != nullptr) {
+        if (stamp) {
+            std::chrono::steady_clock::rep expected { 0 };
+            m_first_enqueue.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+        }
+        m_metrics->items_in.add();
+        m_metrics->queue_depth.update(pending());
+    }
+    if (cooperative()) {
+        resume();
+    } else {
+        m_notifier.notify();
+    }
 }
 
 template <typename T>
-auto threaded<T>::step() -> int
+auto threaded<T>::push_locked(T&& item) -> bool
 {
-    std::mutex mx;
-    std::unique_lock<std::mutex> wait_lock { mx };
-    if ((m_items.empty()) && (m_condition.wait_for(wait_lock, m_timeout) == std::cv_status::timeout)) {
-        return process();
+    std::unique_lock<std::mutex> lock { m_mutex };
+    const auto full { [this] { return (m_config.capacity > 0) && ((m_items.size() - m_head) >= m_config.capacity); } };
+    if (full()) {
+        if (m_config.overflow == threaded_configuration::overflow_t::block) {
+            m_not_full.wait(lock, [this, &full] { return m_quit || !full(); });
+            if (m_quit) {
+                m_dropped++;
+                return false;
+            }
+        } else if (!keep_overflow()) {
+            return false;
+        } else {
+            // the evicted items stay in place until the consumer swaps the buffer,
+            // or until they make up half of it.
+            m_head++;
+            m_dropped++;
+            if (m_head >= m_config.capacity) {
+                m_items.erase(m_items.begin(), m_items.begin() + static_cast<std::ptrdiff_t>(m_head));
+                m_head = 0;
+            }
+        }
     }
-    if (m_quit) {
-        return 0;
+    m_items.emplace_back(std::move(item));
+    m_pending = m_items.size() - m_head;
+    return true;
+}
+
+template <typename T>
+auto threaded<T>::push_lockfree(T&& item) -> bool
+{
+    for (std::size_t attempt { 0 }; !m_ring->try_push(std::move(item)); attempt++) {
+        if (m_config.overflow == threaded_configuration::overflow_t::block) {
+            if (m_quit) {
+                m_dropped++;
+                return false;
+            }
+            if (attempt < s_full_spins) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(s_full_backoff);
+            }
+        } else if ((attempt == 0) && !keep_overflow()) {
+            return false;
+        } else if (m_ring->try_pop().has_value()) {
+            m_dropped++;
+        }
     }
+    return true;
+}
 
-    std::size_t n { 0 };
-    do {
-        auto item = [this]() -> T {
-            std::scoped_lock<std::mutex> lock { m_mutex };
-            T res = m_items.front();
-            m_items.pop();
-            return res;
-        }();
+template <typename T>
+auto threaded<T>::keep_overflow() -> bool
+{
+    switch (m_config.overflow) {
+    case threaded_configuration::overflow_t::drop_oldest:
+        return true;
+    case threaded_configuration::overflow_t::sample:
+        if ((m_overflows++ % m_config.sample_every) == 0) {
+            return true;
+        }
+        break;
+    case threaded_configuration::overflow_t::block:
+    case threaded_configuration::overflow_t::drop_newest:
+        break;
+    }
+    m_dropped++;
+    return false;
+}
+
+template <typename T>
+auto threaded<T>::step() -> int
+{
+    if (m_batch_position >= m_batch.size()) {
+        if ((pending() == 0) && cooperative()) {
+            suspend(m_config.timeout);
+            return process();
+        }
+        if ((pending() == 0) && !m_notifier.wait_for(m_config.timeout)) {
+            return process();
+        }
+        if (m_quit) {
+            return 0;
+        }
+        linger();
+        fill_batch();
+    }
 
-        int result { process(item) };
+    const std::size_t count { std::min(m_config.max_batch, m_batch.size() - m_batch_position) };
+    if (count > 0) {
+        const std::size_t position { m_batch_position };
+        m_batch_position += count;
+        const auto start { (m_metrics != nullptr) ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point {} };
+        int result { process_batch(span<T> { m_batch.data() + position, count }) };
+        if (m_metrics != nullptr) {
+            m_metrics->process_time.add(std::chrono::steady_clock::now() - start);
+            m_metrics->items_out.add(count);
+        }
         if (result != 0) {
             return result;
         }
-        n++;
-    } while (!m_items.empty() && (n < 10));
-    if (!m_items.empty()) {
-        m_condition.notify_all();
     }
     return process();
 }
 
+template <typename T>
+auto threaded<T>::process_batch(span<T> items) -> int
+{
+    for (auto& item : items) {
+        int result { process(std::move(item)) };
+        if (result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+template <typename T>
+void threaded<T>::fill_batch()
+{
+    m_batch.clear();
+    m_batch_position = 0;
+    const std::chrono::steady_clock::rep enqueued { m_first_enqueue.exchange(0, std::memory_order_relaxed) };
+    if ((m_metrics != nullptr) && (enqueued != 0)) {
+        const std::chrono::steady_clock::time_point first { std::chrono::steady_clock::duration { enqueued } };
+        m_metrics->queue_time.add(std::chrono::steady_clock::now() - first);
+    }
+    if (m_ring != nullptr) {
+        while (m_batch.size() < m_config.max_batch) {
+            auto item { m_ring->try_pop() };
+            if (!item.has_value()) {
+                break;
+            }
+            m_batch.emplace_back(std::move(*item));
+        }
+        const std::size_t remaining { m_ring->size() };
+        if ((enqueued != 0) && (remaining > 0)) {
+            // assumes evenly spaced arrivals to estimate when the oldest remaining item was pushed
+            const auto now { std::chrono::steady_clock::now().time_since_epoch().count() };
+            const auto taken { static_cast<std::chrono::steady_clock::rep>(m_batch.size()) };
+            const auto estimate { enqueued + ((now - enqueued) * taken) / (taken + static_cast<std::chrono::steady_clock::rep>(remaining)) };
+            std::chrono::steady_clock::rep expected { 0 };
+            m_first_enqueue.compare_exchange_strong(expected, estimate, std::memory_order_relaxed);
+        }
+        return;
+    }
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        std::swap(m_items, m_batch);
+        m_batch_position = m_head;
+        m_head = 0;
+        m_pending = 0;
+    }
+    m_not_full.notify_all();
+}
+
+template <typename T>
+void threaded<T>::linger()
+{
+    if ((m_config.batch_latency.count() <= 0) || cooperative()) {
+        return;
+    }
+    const auto deadline { std::chrono::steady_clock::now() + m_config.batch_latency };
+    while (!m_quit && (pending() < m_config.max_batch)) {
+        const auto now { std::chrono::steady_clock::now() };
+        if (now >= deadline) {
+            return;
+        }
+        static_cast<void>(m_notifier.wait_for(std::chrono::duration_cast<std::chrono::microseconds>(deadline - now)));
+    }
+}
+
+template <typename T>
+auto threaded<T>::pending() const -> std::size_t
+{
+    if (m_ring != nullptr) {
+        return m_ring->size();
+    }
+    return m_pending;
+}
+
+template <typename T>
+auto threaded<T>::dropped() const -> std::size_t
+{
+    return m_dropped;
+}
+
+template <typename T>
+auto threaded<T>::stage_metrics() -> metrics::stage*
+{
+    return m_metrics.get();
+}
+
+template <typename T>
+auto threaded<T>::overloaded() const -> bool
+{
+    if (m_ring != nullptr) {
+        return m_ring->size() >= m_ring->capacity();
+    }
+    return (m_config.capacity > 0) && (m_pending >= m_config.capacity);
+}
+
+template <typename T>
+void threaded<T>::on_stop()
+{
+    m_notifier.notify();
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+    }
+    m_not_full.notify_all();
+}
+
 template <typename T>
 auto threaded<T>::process() -> int
 {
@@ -191,8 +651,19 @@ auto threaded<T>::process() -> int
 template <typename T>
 collection<T>::collection(std::vector<base<T>*> sinks, const std::string& name)
     : threaded<T> { name }
-    , m_sinks { std::move(sinks) }
 {
+    for (auto* sink : sinks) {
+        emplace(*sink);
+    }
+}
+
+template <typename T>
+collection<T>::collection(std::vector<base<T>*> sinks, threaded_configuration queue, const std::string& name)
+    : threaded<T> { name }
+{
+    for (auto* sink : sinks) {
+        emplace(*sink, queue);
+    }
 }
 
 template <typename T>
@@ -202,7 +673,16 @@ collection<T>::collection(const std::string& name)
 }
 
 template <typename T>
-collection<T>::~collection() = default;
+collection<T>::~collection()
+{
+    threaded<T>::finish();
+    for (auto& fwd : m_queued) {
+        fwd->stop();
+    }
+    for (auto& fwd : m_queued) {
+        fwd->join();
+    }
+}
 
 template <typename T>
 void collection<T>::get(T item)
@@ -213,9 +693,23 @@ void collection<T>::get(T item)
 template <typename T>
 auto collection<T>::process(T item) -> int
 {
-    for (auto& fwd : m_sinks) {
-        fwd.put(item);
+    if (!m_queued.empty()) {
+        if (m_sinks.empty() && (m_queued.size() == 1)) {
+            m_queued.front()->get(shared_t { {}, std::make_shared<T>(std::move(item)) });
+            return 0;
+        }
+        const std::shared_ptr<const T> shared { m_sinks.empty() ? std::make_shared<const T>(std::move(item)) : std::make_shared<const T>(item) };
+        for (auto& fwd : m_queued) {
+            fwd->get(shared_t { shared, {} });
+        }
     }
+    if (m_sinks.empty()) {
+        return 0;
+    }
+    for (std::size_t i { 0 }; (i + 1) < m_sinks.size(); i++) {
+        m_sinks[i].put(item);
+    }
+    m_sinks.back().put(std::move(item));
     return 0;
 }
 
@@ -225,6 +719,42 @@ void collection<T>::emplace(base<T>& sink)
     m_sinks.emplace_back(forward { sink });
 }
 
+template <typename T>
+void collection<T>::emplace(base<T>& sink, threaded_configuration queue)
+{
+    m_queued.emplace_back(std::make_unique<queued_forward>(sink, queue));
+}
+
+template <typename T>
+collection<T>::queued_forward::queued_forward(base<T>& sink, threaded_configuration queue)
+    : threaded<shared_t> { "muon::fanout", queue }
+    , m_sink { sink }
+{
+}
+
+template <typename T>
+collection<T>::queued_forward::~queued_forward()
+{
+    threaded<shared_t>::finish();
+}
+
+template <typename T>
+void collection<T>::queued_forward::get(shared_t item)
+{
+    threaded<shared_t>::internal_get(std::move(item));
+}
+
+template <typename T>
+auto collection<T>::queued_forward::process(shared_t item) -> int
+{
+    if (item.owned != nullptr) {
+        m_sink.get(std::move(*item.owned));
+    } else {
+        m_sink.get_shared(std::move(item.shared));
+    }
+    return 0;
+}
+
 }
 
 #endif // SINKBASE_H
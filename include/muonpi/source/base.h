@@ -31,8 +31,15 @@ protected:
     /**
      * @brief put pushes an item into the source
      * @param item The item to push
+     * @return false if the sink is overloaded and the producer should shed load
      */
-    void put(T item);
+    auto put(T item) -> bool;
+
+    /**
+     * @brief sink_overloaded Checks whether the sink this source feeds can currently keep up.
+     * @return true if the sink is overloaded
+     */
+    [[nodiscard]] auto sink_overloaded() const -> bool;
 
 private:
     sink::base<T>& m_sink;
@@ -48,9 +55,16 @@ template <typename T>
 base<T>::~base() = default;
 
 template <typename T>
-void base<T>::put(T item)
+auto base<T>::put(T item) -> bool
 {
     m_sink.get(std::move(item));
+    return !m_sink.overloaded();
+}
+
+template <typename T>
+auto base<T>::sink_overloaded() const -> bool
+{
+    return m_sink.overloaded();
 }
 
 }
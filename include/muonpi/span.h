@@ -0,0 +1,85 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include "muonpi/global.h"
+
+#include <cstddef>
+
+namespace muonpi {
+
+/**
+ * @brief The span class. A non owning view of a contiguous range of items, modelled after std::span.
+ * @param T The type of the items
+ */
+template <typename T>
+class LIBMUONPI_PUBLIC span {
+public:
+    using element_type = T;
+    using iterator = T*;
+
+    constexpr span() noexcept = default;
+
+    constexpr span(T* data, std::size_t size) noexcept
+        : m_data { data }
+        , m_size { size }
+    {
+    }
+
+    [[nodiscard]] constexpr auto data() const noexcept -> T*
+    {
+        return m_data;
+    }
+
+    [[nodiscard]] constexpr auto size() const noexcept -> std::size_t
+    {
+        return m_size;
+    }
+
+    [[nodiscard]] constexpr auto empty() const noexcept -> bool
+    {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] constexpr auto begin() const noexcept -> iterator
+    {
+        return m_data;
+    }
+
+    [[nodiscard]] constexpr auto end() const noexcept -> iterator
+    {
+        return m_data + m_size;
+    }
+
+    [[nodiscard]] constexpr auto operator[](std::size_t i) const -> T&
+    {
+        return m_data[i];
+    }
+
+    [[nodiscard]] constexpr auto front() const -> T&
+    {
+        return *m_data;
+    }
+
+    [[nodiscard]] constexpr auto back() const -> T&
+    {
+        return m_data[m_size - 1];
+    }
+
+    /**
+     * @brief subspan A view of a part of this span
+     * @param offset The index of the first item
+     * @param count The number of items
+     */
+    [[nodiscard]] constexpr auto subspan(std::size_t offset, std::size_t count) const -> span<T>
+    {
+        return span<T> { m_data + offset, count };
+    }
+
+private:
+    T* m_data { nullptr };
+    std::size_t m_size { 0 };
+};
+
+}
+
+#endif // SPAN_H
@@ -3,8 +3,15 @@
 
 #include "muonpi/global.h"
 
+#include "muonpi/executor.h"
+#include "muonpi/placement.h"
+
 #include <atomic>
+#include <chrono>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <string>
 
 namespace muonpi {
 
@@ -63,11 +70,42 @@ public:
      */
     [[nodiscard]] auto state_string() -> std::string;
 
+    /**
+     * @brief set_placement Sets the cpus, scheduling policy and NUMA node of the thread.
+     * Has to be called before start(), the placement is applied when the thread starts.
+     * Runners started on an executor ignore it, the executor places its workers itself.
+     * @param placement The placement to apply
+     */
+    void set_placement(thread_placement placement);
+
+    /**
+     * @brief placement The placement which was requested with set_placement
+     */
+    [[nodiscard]] auto placement() const -> thread_placement;
+
+    /**
+     * @brief placement_string The effective placement of the thread, as reported by the kernel once the thread started.
+     * @return The placement in the format of thread_placement::to_string, empty if the thread did not start yet
+     */
+    [[nodiscard]] auto placement_string() -> std::string;
+
     /**
      * @brief start Starts the thread asynchronuosly
      */
     void start();
 
+    /**
+     * @brief start Runs the main loop as cooperative tasks on an executor instead of a dedicated thread.
+     * Every call to step() is one task, so step() should not block for long.
+     * Runners with a custom main loop fall back to a dedicated thread.
+     * If the executor is destroyed before the runner finished, the runner ends in State::Error without calling post_run(),
+     * and wait() returns -1.
+     * @param exec The executor to run on
+     * @param priority The priority of the tasks of this runner
+     * @param worker The index of the worker the runner is pinned to, -1 lets any worker run it
+     */
+    void start(executor& exec, executor::Priority priority = executor::Priority::Normal, int worker = -1);
+
     /**
      * @brief start_synchronuos Starts the thread synchronuosly
      */
@@ -110,12 +148,65 @@ protected:
      */
     [[nodiscard]] virtual auto post_run() -> int;
 
+    /**
+     * @brief cooperative Indicates whether the runner was started on an executor
+     */
+    [[nodiscard]] auto cooperative() const -> bool;
+
+    /**
+     * @brief suspend Only has an effect on an executor, when called from within step().
+     * The runner is not rescheduled after the current step until resume() is called or the timeout elapsed.
+     * @param timeout The maximum time to stay suspended
+     */
+    void suspend(std::chrono::microseconds timeout);
+
+    /**
+     * @brief resume Reschedules a suspended runner on its executor. Does nothing otherwise.
+     */
+    void resume();
+
     std::condition_variable m_condition;
-    bool m_quit { false };
+    std::atomic<bool> m_quit { false };
 
 private:
+    enum class Schedule {
+        Active,
+        Suspended,
+        Finished
+    };
+
+    /**
+     * @brief The timer_guard struct. Lets tasks of the executor timer find out whether the runner still exists.
+     */
+    struct timer_guard {
+        std::mutex mutex {};
+        thread_runner* runner { nullptr };
+    };
+
     void set_state(State state);
 
+    void cooperative_begin();
+    void cooperative_step();
+    void cooperative_end(int result);
+    void reschedule();
+
+    /**
+     * @brief on_timer Called when the suspension timer expired. Resumes the runner if its suspension timed out.
+     */
+    void on_timer();
+
+    /**
+     * @brief arm_timer Makes sure the suspension timer expires no later than a deadline.
+     * Only touches the executor if the timer is not armed already for an earlier time.
+     * @param deadline The deadline
+     */
+    void arm_timer(std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief detach_executor Tells the executor that the runner no longer needs to know when it gets destroyed
+     */
+    void detach_executor();
+
     bool m_use_custom_run { false };
 
     std::atomic<bool> m_run { true };
@@ -131,6 +222,31 @@ private:
     std::unique_ptr<std::thread> m_thread { nullptr };
 
     std::condition_variable m_state_condition;
+
+    executor* m_executor { nullptr };
+    executor::Priority m_priority { executor::Priority::Normal };
+    int m_worker { -1 };
+    std::promise<int> m_run_promise {};
+    std::atomic<Schedule> m_schedule { Schedule::Active };
+    std::atomic<bool> m_resume_pending { false };
+    bool m_suspend_requested { false };
+    std::chrono::microseconds m_suspend_timeout {};
+    /**
+     * @brief m_timer The one executor timer of this runner, which ends suspensions which timed out
+     */
+    std::size_t m_timer { 0 };
+    std::atomic<std::chrono::steady_clock::rep> m_wake_at { 0 };
+    /**
+     * @brief m_timer_deadline The time the timer is armed for, time_point::max() if it is not armed
+     */
+    std::atomic<std::chrono::steady_clock::rep> m_timer_deadline { std::chrono::steady_clock::time_point::max().time_since_epoch().count() };
+    std::shared_ptr<timer_guard> m_guard { std::make_shared<timer_guard>() };
+    std::atomic<bool> m_attached { false };
+    std::size_t m_attachment { 0 };
+
+    thread_placement m_placement {};
+    std::mutex m_placement_mutex {};
+    std::string m_effective_placement {};
 };
 
 }
@@ -1,6 +1,14 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace muonpi {
@@ -27,6 +35,31 @@ template <typename T,
     return value;
 }
 
+/**
+ * @brief to_bytes Appends the object representation of a value to a byte string
+ * @param value The value to append
+ * @param bytes The string to append to
+ */
+template <typename T,
+    std::enable_if_t<std::is_trivially_copyable<T>::value, bool> = true>
+void to_bytes(const T& value, std::string& bytes)
+{
+    bytes.append(reinterpret_cast<const char*>(std::addressof(value)), sizeof(T));
+}
+
+/**
+ * @brief from_bytes Reads a value from the start of a byte string
+ * @param bytes The bytes to read from. Has to contain at least sizeof(T) bytes.
+ */
+template <typename T,
+    std::enable_if_t<std::is_trivially_copyable<T>::value, bool> = true>
+[[nodiscard]] auto from_bytes(std::string_view bytes) -> T
+{
+    T value {};
+    std::memcpy(std::addressof(value), bytes.data(), sizeof(T));
+    return value;
+}
+
 }
 
 #endif // TYPES_H
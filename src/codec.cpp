@@ -0,0 +1,88 @@
+#include "muonpi/codec.h"
+
+namespace muonpi::codec {
+
+namespace {
+    constexpr std::uint16_t s_magic { 0x424d }; // "MB"
+    constexpr std::uint8_t s_format { 1 };
+    constexpr std::uint8_t s_continuation { 0x80 };
+    constexpr std::uint8_t s_payload { 0x7f };
+    constexpr std::size_t s_max_varint { 10 };
+    /**
+     * @brief s_max_last_byte The tenth byte of a varint only holds the highest bit of a 64 bit value
+     */
+    constexpr std::uint8_t s_max_last_byte { 1 };
+}
+
+void detail::write_varint(std::uint64_t value, std::string& bytes)
+{
+    while (value >= s_continuation) {
+        bytes.push_back(static_cast<char>(static_cast<std::uint8_t>(value) | s_continuation));
+        value >>= 7U;
+    }
+    bytes.push_back(static_cast<char>(value));
+}
+
+auto detail::read_varint(std::string_view& bytes) -> std::uint64_t
+{
+    std::uint64_t value { 0 };
+    for (std::size_t i { 0 }; (i < bytes.size()) && (i < s_max_varint); i++) {
+        const auto byte { static_cast<std::uint8_t>(bytes[i]) };
+        if ((i == (s_max_varint - 1)) && (byte > s_max_last_byte)) {
+            throw error::codec_error { "varint exceeds 64 bits" };
+        }
+        value |= static_cast<std::uint64_t>(byte & s_payload) << (7U * i);
+        if ((byte & s_continuation) == 0) {
+            bytes.remove_prefix(i + 1);
+            return value;
+        }
+    }
+    throw error::codec_error { "truncated varint" };
+}
+
+auto detail::take(std::string_view& bytes, std::size_t count) -> std::string_view
+{
+    if (bytes.size() < count) {
+        throw error::codec_error { "truncated frame" };
+    }
+    const std::string_view front { bytes.substr(0, count) };
+    bytes.remove_prefix(count);
+    return front;
+}
+
+void detail::write_header(const header_t& header, std::string& bytes)
+{
+    to_bytes(s_magic, bytes);
+    to_bytes(s_format, bytes);
+    to_bytes(static_cast<std::uint8_t>(header.encoding), bytes);
+    to_bytes(header.schema, bytes);
+    to_bytes(header.version, bytes);
+    write_varint(header.count, bytes);
+}
+
+auto detail::read_header(std::string_view& bytes) -> header_t
+{
+    if (from_bytes<std::uint16_t>(take(bytes, sizeof(s_magic))) != s_magic) {
+        throw error::codec_error { "not a binary frame" };
+    }
+    if (from_bytes<std::uint8_t>(take(bytes, sizeof(s_format))) != s_format) {
+        throw error::codec_error { "unsupported frame format" };
+    }
+    header_t header {};
+    const auto encoding { from_bytes<std::uint8_t>(take(bytes, sizeof(std::uint8_t))) };
+    if (encoding > static_cast<std::uint8_t>(Encoding::Varint)) {
+        throw error::codec_error { "unknown encoding" };
+    }
+    header.encoding = static_cast<Encoding>(encoding);
+    header.schema = from_bytes<std::uint16_t>(take(bytes, sizeof(header.schema)));
+    header.version = from_bytes<std::uint16_t>(take(bytes, sizeof(header.version)));
+    header.count = read_varint(bytes);
+    return header;
+}
+
+auto peek(std::string_view frame) -> header_t
+{
+    return detail::read_header(frame);
+}
+
+} // namespace muonpi::codec
@@ -1,21 +1,29 @@
 #ifndef MUONPI_HTTP_SESSION_H
 #define MUONPI_HTTP_SESSION_H
 #include "muonpi/base64.h"
+#include "muonpi/http_server.h"
 #include "muonpi/http_tools.h"
 #include "muonpi/log.h"
-#include "muonpi/scopeguard.h"
 
-#include <condition_variable>
-#include <sstream>
+#include <functional>
+#include <memory>
+#include <type_traits>
 #include <utility>
 
 namespace muonpi::http::detail {
 
+/**
+ * @brief The session class. Serves the requests of one connection.
+ * A session is driven entirely by asynchronous operations on its stream. All handlers of a session run on
+ * the strand of the accepted socket, so a session never runs on two threads at the same time.
+ * Each pending operation holds a reference to the session, it gets destroyed after its last operation finished.
+ */
 template <typename Stream>
-class session {
+class session : public std::enable_shared_from_this<session<Stream>> {
 public:
-    explicit session(tcp::socket&& socket, ssl::context& ctx, std::function<response_type(request_type)> handler);
-    explicit session(tcp::socket&& socket, std::function<response_type(request_type)> handler);
+
+    explicit session(tcp::socket&& socket, ssl::context& ctx, std::function<any_response(request_type& req, bool& compress)> handler, compression_t compression);
+    explicit session(tcp::socket&& socket, std::function<any_response(request_type& req, bool& compress)> handler, compression_t compression);
 
     void run();
 
@@ -28,118 +36,98 @@ public:
     void on_write(bool close, beast::error_code ec, std::size_t bytes_transferred);
 
 private:
-    void notify();
+    template <typename Body>
+    void do_write(beast::http::response<Body>& response);
+
+    /**
+     * @brief write_some Writes the next part of a response. The timeout restarts with every part,
+     * so large bodies only time out if the client stops reading.
+     */
+    template <typename Body>
+    void write_some(std::shared_ptr<beast::http::response_serializer<Body>> serializer, bool close);
 
     Stream m_stream;
 
     beast::flat_buffer m_buffer;
     request_type m_req;
-    std::shared_ptr<void> m_res;
+    any_response m_res;
 
-    std::function<response_type(request_type)> m_handler;
-
-    std::condition_variable m_done {};
-    std::mutex m_mutex {};
+    std::function<any_response(request_type& req, bool& compress)> m_handler;
+    compression_t m_compression;
 
     constexpr static std::chrono::duration s_timeout { std::chrono::seconds { 30 } };
 };
 
 template <>
-session<ssl_stream_t>::session(tcp::socket&& socket, ssl::context& ctx, std::function<response_type(request_type)> handler)
+session<ssl_stream_t>::session(tcp::socket&& socket, ssl::context& ctx, std::function<any_response(request_type& req, bool& compress)> handler, compression_t compression)
     : m_stream { std::move(socket), ctx }
     , m_handler { std::move(handler) }
+    , m_compression { compression }
 {
 }
 
 template <>
-session<tcp_stream_t>::session(tcp::socket&& socket, std::function<response_type(request_type)> handler)
+session<tcp_stream_t>::session(tcp::socket&& socket, std::function<any_response(request_type& req, bool& compress)> handler, compression_t compression)
     : m_stream { std::move(socket) }
     , m_handler { std::move(handler) }
+    , m_compression { compression }
 {
 }
 
 template <>
 void session<ssl_stream_t>::run()
 {
-#if BOOST_VERSION >= 106900
-    beast::get_lowest_layer(m_stream).expires_after(s_timeout);
-#endif
-    m_stream.async_handshake(ssl::stream_base::server, [&](beast::error_code ec) {
-        scope_guard guard { [&] { notify(); } };
-        if (ec) {
-            fail(ec, "handshake");
-            return;
-        }
-        guard.dismiss();
-        do_read();
+    net::dispatch(m_stream.get_executor(), [self { shared_from_this() }] {
+        beast::get_lowest_layer(self->m_stream).expires_after(s_timeout);
+        self->m_stream.async_handshake(ssl::stream_base::server, [self](beast::error_code ec) {
+            if (ec) {
+                fail(ec, "handshake");
+                return;
+            }
+            self->do_read();
+        });
     });
-
-    std::unique_lock<std::mutex> lock { m_mutex };
-    m_done.wait(lock);
 }
 
 template <>
 void session<tcp_stream_t>::run()
 {
-#if BOOST_VERSION >= 106900
-    beast::get_lowest_layer(m_stream).expires_after(s_timeout);
-#endif
-    net::dispatch(m_stream.get_executor(), [&] { do_read(); });
-
-    std::unique_lock<std::mutex> lock { m_mutex };
-    m_done.wait(lock);
+    net::dispatch(m_stream.get_executor(), [self { shared_from_this() }] { self->do_read(); });
 }
 
 template <>
 void session<ssl_stream_t>::do_close()
 {
-#if BOOST_VERSION >= 106900
     beast::get_lowest_layer(m_stream).expires_after(s_timeout);
-#endif
-    scope_guard guard { [&] { notify(); } };
-    m_stream.async_shutdown([&](beast::error_code ec) {
+    m_stream.async_shutdown([self { shared_from_this() }](beast::error_code ec) {
         if (ec) {
             fail(ec, "shutdown");
         }
-        notify();
     });
-    guard.dismiss();
 }
 
 template <>
 void session<tcp_stream_t>::do_close()
 {
-    scope_guard guard { [&] { notify(); } };
     beast::error_code ec;
-#if BOOST_VERSION >= 106900
-    beast::get_lowest_layer(m_stream).expires_after(s_timeout);
     m_stream.socket().shutdown(tcp::socket::shutdown_send, ec);
-#else
-    m_stream.shutdown(tcp::socket::shutdown_send, ec);
-#endif
     if (ec) {
         fail(ec, "shutdown");
     }
-    guard.dismiss();
 }
 
 template <typename Stream>
 void session<Stream>::do_read()
 {
-    scope_guard guard { [&] { notify(); } };
     m_req = {};
 
-#if BOOST_VERSION >= 106900
     beast::get_lowest_layer(m_stream).expires_after(s_timeout);
-#endif
-    beast::http::async_read(m_stream, m_buffer, m_req, [&](beast::error_code ec, std::size_t bytes_transferred) { on_read(ec, bytes_transferred); });
-    guard.dismiss();
+    beast::http::async_read(m_stream, m_buffer, m_req, [self { this->shared_from_this() }](beast::error_code ec, std::size_t bytes_transferred) { self->on_read(ec, bytes_transferred); });
 }
 
 template <typename Stream>
 void session<Stream>::on_read(beast::error_code errorcode, std::size_t bytes_transferred)
 {
-    scope_guard guard { [&] { notify(); } };
     boost::ignore_unused(bytes_transferred);
 
     if (errorcode == beast::http::error::end_of_stream) {
@@ -152,23 +140,64 @@ void session<Stream>::on_read(beast::error_code errorcode, std::size_t bytes_tra
         return;
     }
 
-    auto sp { std::make_shared<beast::http::message<false, beast::http::string_body>>(m_handler(std::move(m_req))) };
+    bool compressible { m_compression.enabled };
+    try {
+        m_res = m_handler(m_req, compressible);
+    } catch (std::exception& e) {
+        log::warning("http") << "Handler for '" << m_req.target() << "' threw: " << e.what();
+        m_res = http_response<beast::http::status::internal_server_error>(m_req)("Internal server error");
+    } catch (...) {
+        log::warning("http") << "Handler for '" << m_req.target() << "' threw.";
+        m_res = http_response<beast::http::status::internal_server_error>(m_req)("Internal server error");
+    }
+
+    if (auto* plain { std::get_if<response_type>(&m_res) }; (plain != nullptr) && compressible) {
+        const auto accepted { m_req[http_field::accept_encoding] };
+        compress_response(*plain, { accepted.data(), accepted.size() }, m_compression);
+    }
+
+    std::visit([this](auto& response) { do_write(response); }, m_res);
+}
+
+template <typename Stream>
+template <typename Body>
+void session<Stream>::do_write(beast::http::response<Body>& response)
+{
+    const bool close { response.need_eof() };
+    if constexpr (std::is_same_v<Body, beast::http::string_body>) {
+        beast::http::async_write(
+            m_stream,
+            response,
+            [self { this->shared_from_this() }, close](beast::error_code ec, std::size_t bytes) {
+                self->on_write(close, ec, bytes);
+            });
+    } else {
+        // bodies of files and producers get serialised piece by piece, so only one chunk is buffered at a time
+        write_some(std::make_shared<beast::http::response_serializer<Body>>(response), close);
+    }
+}
 
-    bool close { sp->need_eof() };
-    m_res = sp;
-    beast::http::async_write(
+template <typename Stream>
+template <typename Body>
+void session<Stream>::write_some(std::shared_ptr<beast::http::response_serializer<Body>> serializer, bool close)
+{
+    beast::get_lowest_layer(m_stream).expires_after(s_timeout);
+    auto& current { *serializer };
+    beast::http::async_write_some(
         m_stream,
-        *sp,
-        [&](beast::error_code ec, std::size_t bytes) {
-            on_write(close, ec, bytes);
+        current,
+        [self { this->shared_from_this() }, serializer { std::move(serializer) }, close](beast::error_code ec, std::size_t bytes) mutable {
+            if (!ec && !serializer->is_done()) {
+                self->write_some(std::move(serializer), close);
+                return;
+            }
+            self->on_write(close, ec, bytes);
         });
-    guard.dismiss();
 }
 
 template <typename Stream>
 void session<Stream>::on_write(bool close, beast::error_code ec, std::size_t bytes_transferred)
 {
-    scope_guard guard { [&] { notify(); } };
     boost::ignore_unused(bytes_transferred);
 
     if (ec) {
@@ -181,16 +210,9 @@ void session<Stream>::on_write(bool close, beast::error_code ec, std::size_t byt
         return;
     }
 
-    m_res = nullptr;
+    m_res = {};
 
     do_read();
-    guard.dismiss();
-}
-
-template <typename Stream>
-void session<Stream>::notify()
-{
-    m_done.notify_all();
 }
 
 } // namespace muonpi::http
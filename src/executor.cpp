@@ -0,0 +1,304 @@
+#include "muonpi/executor.h"
+
+#include "muonpi/log.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <string>
+
+namespace muonpi {
+
+namespace {
+    thread_local const executor* s_current { nullptr };
+    thread_local std::size_t s_current_index { 0 };
+}
+
+executor::executor(std::size_t workers)
+{
+    start(std::max<std::size_t>(workers, 1));
+}
+
+executor::executor(const std::vector<int>& cpus)
+    : m_cpus { cpus }
+{
+    start(std::max<std::size_t>(cpus.size(), 1));
+}
+
+executor::~executor()
+{
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        m_running = false;
+    }
+    m_condition.notify_all();
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    std::map<std::size_t, std::function<void()>> abandoned {};
+    {
+        std::scoped_lock<std::mutex> lock { m_attached_mutex };
+        abandoned.swap(m_attached);
+    }
+    for (auto& [id, abandon] : abandoned) {
+        abandon();
+    }
+}
+
+void executor::start(std::size_t workers)
+{
+    for (std::size_t i { 0 }; i < workers; i++) {
+        m_workers.emplace_back(std::make_unique<worker_t>());
+    }
+    for (std::size_t i { 0 }; i < workers; i++) {
+        m_workers[i]->thread = std::thread { &executor::run, this, i };
+    }
+}
+
+auto executor::size() const -> std::size_t
+{
+    return m_workers.size();
+}
+
+auto executor::attach(std::function<void()> abandon) -> std::size_t
+{
+    std::scoped_lock<std::mutex> lock { m_attached_mutex };
+    const std::size_t id { m_next_attachment++ };
+    m_attached.emplace(id, std::move(abandon));
+    return id;
+}
+
+void executor::detach(std::size_t id)
+{
+    std::scoped_lock<std::mutex> lock { m_attached_mutex };
+    m_attached.erase(id);
+}
+
+void executor::post(task_t task, Priority priority, int worker)
+{
+    const auto level { static_cast<std::size_t>(priority) };
+    const bool pinned { (worker >= 0) && (static_cast<std::size_t>(worker) < m_workers.size()) };
+    std::size_t index {};
+    if (pinned) {
+        index = static_cast<std::size_t>(worker);
+    } else if (s_current == this) {
+        index = s_current_index;
+    } else {
+        index = m_next++ % m_workers.size();
+    }
+    {
+        auto& target { *m_workers[index] };
+        std::scoped_lock<std::mutex> lock { target.mutex };
+        if (pinned) {
+            target.pinned[level].emplace_back(std::move(task));
+            target.pinned_count++;
+        } else {
+            target.shared[level].emplace_back(std::move(task));
+            m_queued++;
+        }
+    }
+    wake(pinned);
+}
+
+void executor::post_after(std::chrono::steady_clock::duration delay, task_t task, Priority priority, int worker)
+{
+    const auto deadline { std::chrono::steady_clock::now() + delay };
+    bool earliest { false };
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        const std::size_t id { m_next_timer++ };
+        auto& timer { m_timers.emplace(id, timer_t { std::move(task), priority, worker, true }).first->second };
+        earliest = arm(id, timer, deadline);
+    }
+    if (earliest) {
+        m_condition.notify_one();
+    }
+}
+
+auto executor::create_timer(task_t task, Priority priority, int worker) -> std::size_t
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    const std::size_t id { m_next_timer++ };
+    m_timers.emplace(id, timer_t { std::move(task), priority, worker, false });
+    return id;
+}
+
+void executor::arm_timer(std::size_t id, std::chrono::steady_clock::time_point deadline)
+{
+    bool earliest { false };
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        auto it { m_timers.find(id) };
+        if (it == m_timers.end()) {
+            return;
+        }
+        earliest = arm(id, it->second, deadline);
+    }
+    // sleeping workers only need to wake up early if the next deadline moved
+    if (earliest) {
+        m_condition.notify_one();
+    }
+}
+
+void executor::destroy_timer(std::size_t id)
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    auto it { m_timers.find(id) };
+    if (it == m_timers.end()) {
+        return;
+    }
+    if (it->second.deadline.has_value()) {
+        m_deadlines.erase({ *it->second.deadline, id });
+    }
+    m_timers.erase(it);
+}
+
+auto executor::arm(std::size_t id, timer_t& timer, std::chrono::steady_clock::time_point deadline) -> bool
+{
+    if (timer.deadline.has_value()) {
+        if (*timer.deadline <= deadline) {
+            return false;
+        }
+        m_deadlines.erase({ *timer.deadline, id });
+    }
+    timer.deadline = deadline;
+    m_deadlines.emplace(deadline, id);
+    if (m_deadlines.begin()->second != id) {
+        return false;
+    }
+    m_next_deadline = deadline.time_since_epoch().count();
+    return true;
+}
+
+void executor::wake(bool all)
+{
+    if (m_sleeping == 0) {
+        return;
+    }
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+    }
+    if (all) {
+        m_condition.notify_all();
+    } else {
+        m_condition.notify_one();
+    }
+}
+
+auto executor::take(std::size_t index) -> std::optional<task_t>
+{
+    {
+        auto& own { *m_workers[index] };
+        std::scoped_lock<std::mutex> lock { own.mutex };
+        for (std::size_t level { s_priorities }; level-- > 0;) {
+            if (!own.pinned[level].empty()) {
+                task_t task { std::move(own.pinned[level].front()) };
+                own.pinned[level].pop_front();
+                own.pinned_count--;
+                return task;
+            }
+            if (!own.shared[level].empty()) {
+                task_t task { std::move(own.shared[level].front()) };
+                own.shared[level].pop_front();
+                m_queued--;
+                return task;
+            }
+        }
+    }
+    for (std::size_t level { s_priorities }; level-- > 0;) {
+        for (std::size_t offset { 1 }; offset < m_workers.size(); offset++) {
+            auto& victim { *m_workers[(index + offset) % m_workers.size()] };
+            std::unique_lock<std::mutex> lock { victim.mutex, std::try_to_lock };
+            if (!lock.owns_lock() || victim.shared[level].empty()) {
+                continue;
+            }
+            task_t task { std::move(victim.shared[level].back()) };
+            victim.shared[level].pop_back();
+            m_queued--;
+            return task;
+        }
+    }
+    return std::nullopt;
+}
+
+void executor::fire_timers()
+{
+    std::vector<timer_t> due {};
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        const auto now { std::chrono::steady_clock::now() };
+        while (!m_deadlines.empty() && (m_deadlines.begin()->first <= now)) {
+            const std::size_t id { m_deadlines.begin()->second };
+            m_deadlines.erase(m_deadlines.begin());
+            auto it { m_timers.find(id) };
+            it->second.deadline.reset();
+            if (it->second.once) {
+                due.emplace_back(std::move(it->second));
+                m_timers.erase(it);
+            } else {
+                due.emplace_back(it->second);
+            }
+        }
+        m_next_deadline = m_deadlines.empty()
+            ? std::chrono::steady_clock::time_point::max().time_since_epoch().count()
+            : m_deadlines.begin()->first.time_since_epoch().count();
+    }
+    for (auto& timer : due) {
+        post(std::move(timer.task), timer.priority, timer.worker);
+    }
+}
+
+void executor::run(std::size_t index)
+{
+    s_current = this;
+    s_current_index = index;
+
+    const std::string name { "muon::exec" + std::to_string(index) };
+    pthread_setname_np(pthread_self(), name.c_str());
+
+    if (!m_cpus.empty()) {
+        cpu_set_t set {};
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[index % m_cpus.size()], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            log::warning("executor") << "Could not pin worker " << index << " to cpu " << m_cpus[index % m_cpus.size()];
+        }
+    }
+
+    while (m_running) {
+        if (std::chrono::steady_clock::now().time_since_epoch().count() >= m_next_deadline) {
+            fire_timers();
+        }
+
+        auto task { take(index) };
+        if (task.has_value()) {
+            try {
+                (*task)();
+            } catch (std::exception& e) {
+                log::error("executor") << "Task got an uncaught exception: " << e.what();
+            } catch (...) {
+                log::error("executor") << "Task got an uncaught exception.";
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock { m_mutex };
+        m_sleeping++;
+        const auto& own { *m_workers[index] };
+        const auto ready { [this, &own] { return (m_queued > 0) || (own.pinned_count > 0) || !m_running || (!m_deadlines.empty() && (m_deadlines.begin()->first <= std::chrono::steady_clock::now())); } };
+        if (m_deadlines.empty()) {
+            m_condition.wait(lock, ready);
+        } else {
+            // the deadline is copied, the timer might be removed while waiting
+            const auto deadline { m_deadlines.begin()->first };
+            m_condition.wait_until(lock, deadline, ready);
+        }
+        m_sleeping--;
+    }
+
+    s_current = nullptr;
+}
+
+} // namespace muonpi
@@ -0,0 +1,124 @@
+#include "muonpi/http_cache.h"
+
+#include <cstdio>
+
+namespace muonpi::http {
+
+namespace {
+    constexpr std::uint64_t s_fnv_offset { 14695981039346656037ULL };
+    constexpr std::uint64_t s_fnv_prime { 1099511628211ULL };
+}
+
+response_cache::response_cache()
+    : response_cache { configuration {} }
+{
+}
+
+response_cache::response_cache(configuration config)
+    : m_config { config }
+{
+}
+
+void response_cache::invalidate()
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    m_entries.clear();
+}
+
+void response_cache::invalidate(std::string_view target)
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    m_entries.erase(std::string { target });
+}
+
+auto response_cache::statistics() const -> statistics_t
+{
+    return statistics_t { m_hits.load(), m_misses.load(), m_not_modified.load() };
+}
+
+auto response_cache::etag(std::string_view body) -> std::string
+{
+    // FNV-1a, clients only compare it for equality
+    std::uint64_t hash { s_fnv_offset };
+    for (const char c : body) {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= s_fnv_prime;
+    }
+    constexpr std::size_t length { 2 + 16 + 1 };
+    char buffer[length] {};
+    std::snprintf(buffer, length, "\"%016llx\"", static_cast<unsigned long long>(hash));
+    return buffer;
+}
+
+auto response_cache::lookup(const std::string& key) -> std::shared_ptr<const entry_t>
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    const auto it { m_entries.find(key) };
+    if (it == m_entries.end()) {
+        return nullptr;
+    }
+    if (it->second->expires <= std::chrono::steady_clock::now()) {
+        m_entries.erase(it);
+        return nullptr;
+    }
+    return it->second;
+}
+
+auto response_cache::store(std::string key, response_type response) -> std::shared_ptr<const entry_t>
+{
+    auto entry { std::make_shared<entry_t>() };
+    entry->etag = etag(response.body());
+    entry->expires = std::chrono::steady_clock::now() + m_config.ttl;
+    response.set(http_field::etag, entry->etag);
+    entry->response = std::move(response);
+
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    if ((m_entries.size() >= m_config.max_entries) && (m_entries.find(key) == m_entries.end())) {
+        const auto now { std::chrono::steady_clock::now() };
+        for (auto it { m_entries.begin() }; it != m_entries.end();) {
+            it = (it->second->expires <= now) ? m_entries.erase(it) : std::next(it);
+        }
+        if (m_entries.size() >= m_config.max_entries) {
+            m_entries.erase(m_entries.begin());
+        }
+    }
+    m_entries.insert_or_assign(std::move(key), entry);
+    return entry;
+}
+
+auto response_cache::respond(const request_type& req, const entry_t& entry, const compression_t* compression) -> response_type
+{
+    const auto accepted { req[http_field::accept_encoding] };
+    const response_type& representation { (compression == nullptr) ? entry.response : variant(entry, accepted_coding({ accepted.data(), accepted.size() }), *compression) };
+    // a weak comparison, so the weakened ETag of a compressed response matches as well
+    const auto match { req[http_field::if_none_match] };
+    if (!match.empty() && ((match == "*") || (match.find(entry.etag) != beast::string_view::npos))) {
+        m_not_modified++;
+        response_type not_modified { http_status::not_modified, req.version() };
+        for (const auto field : { http_field::server, http_field::etag, http_field::vary }) {
+            if (representation.count(field) > 0) {
+                not_modified.set(field, representation[field]);
+            }
+        }
+        not_modified.keep_alive(req.keep_alive());
+        return not_modified;
+    }
+    response_type response { representation };
+    response.version(req.version());
+    response.keep_alive(req.keep_alive());
+    return response;
+}
+
+auto response_cache::variant(const entry_t& entry, std::optional<Coding> coding, const compression_t& compression) -> const response_type&
+{
+    auto& slot { entry.variants[coding.has_value() ? (static_cast<std::size_t>(*coding) + 1) : 0] };
+    std::scoped_lock<std::mutex> lock { entry.mutex };
+    if (!slot.has_value()) {
+        response_type response { entry.response };
+        compress_response(response, coding.has_value() ? coding_name(*coding) : std::string_view {}, compression);
+        slot = std::move(response);
+    }
+    return *slot;
+}
+
+} // namespace muonpi::http
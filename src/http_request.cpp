@@ -2,6 +2,7 @@
 
 #include "muonpi/scopeguard.h"
 
+#include <algorithm>
 #include <future>
 
 namespace muonpi::http {
@@ -60,12 +61,7 @@ template <typename Stream>
     auto const results = resolver.resolve(destination.host, std::to_string(destination.port));
 
     // Make the connection on the IP address we get from a lookup
-
-#if BOOST_VERSION < 106900
-    boost::asio::connect(stream.next_layer(), results.begin(), results.end());
-#else
     beast::get_lowest_layer(stream).connect(results);
-#endif
 
     // Perform the SSL handshake
     stream.handshake(ssl::stream_base::client);
@@ -103,22 +99,14 @@ auto http_request(destination_t destination, std::string body, std::vector<field
     auto const results = resolver.resolve(destination.host, std::to_string(destination.port));
 
     // Make the connection on the IP address we get from a lookup
-#if BOOST_VERSION < 106900
-    boost::asio::connect(stream, results.begin(), results.end());
-#else
     stream.connect(results);
-#endif
 
     response_type res { create_request(stream, std::move(destination), std::move(body), std::move(fields)) };
 
     // Write the message to standard out
     // Gracefully close the socket
     beast::error_code ec;
-#if BOOST_VERSION < 106900
-    stream.shutdown(tcp::socket::shutdown_both, ec);
-#else
     stream.socket().shutdown(tcp::socket::shutdown_both, ec);
-#endif
 
     // not_connected happens sometimes
     // so don't bother reporting it.
@@ -137,4 +125,131 @@ auto http_request(destination_t destination, std::string body, bool ssl, std::ve
     return http_request(std::move(destination), std::move(body), std::move(fields));
 }
 
+struct connection_pool::connection {
+    connection()
+        : stream { ioc }
+    {
+    }
+
+    /**
+     * @brief complete Runs an asynchronous operation on the stream until it finished or the timeout elapsed.
+     * Blocking operations on the socket can not time out, so each connection drives its own io_context instead.
+     * @param initiate Gets called with the completion handler to start the operation
+     * @throws beast::system_error if the operation failed or timed out
+     */
+    template <typename Initiate>
+    void complete(std::chrono::milliseconds timeout, Initiate&& initiate)
+    {
+        beast::error_code result {};
+        stream.expires_after(timeout);
+        initiate([&result](beast::error_code ec, auto&& /*unused*/) { result = ec; });
+        ioc.restart();
+        ioc.run();
+        if (result) {
+            throw beast::system_error { result };
+        }
+    }
+
+    net::io_context ioc {};
+    detail::tcp_stream_t stream;
+    beast::flat_buffer buffer {};
+};
+
+connection_pool::connection_pool(configuration config)
+    : m_config { std::move(config) }
+{
+    m_config.max_connections = std::max<std::size_t>(m_config.max_connections, 1);
+}
+
+connection_pool::~connection_pool() = default;
+
+auto connection_pool::request(http_verb method, const std::string& target, std::string body, const std::vector<field_t>& fields) -> response_type
+{
+    request_type req { method, target, 11 };
+    req.set(http_field::host, m_config.host);
+    req.set(http_field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.set(http_field::content_length, std::to_string(body.size()));
+    for (const auto& [field, value] : fields) {
+        req.set(field, value);
+    }
+    req.keep_alive(true);
+    req.body() = std::move(body);
+
+    bool refreshed { false };
+    for (;;) {
+        bool fresh { false };
+        auto conn { acquire(fresh) };
+        // whatever gets thrown, the connection is closed
+        scope_guard closed { [this] { release(nullptr); } };
+        try {
+            if (fresh) {
+                const auto results { endpoints(refreshed) };
+                conn->complete(m_config.timeout, [&](auto handler) { conn->stream.async_connect(results, std::move(handler)); });
+            }
+            conn->complete(m_config.timeout, [&](auto handler) { beast::http::async_write(conn->stream, req, std::move(handler)); });
+            response_type res {};
+            conn->complete(m_config.timeout, [&](auto handler) { beast::http::async_read(conn->stream, conn->buffer, res, std::move(handler)); });
+            closed.dismiss();
+            release(res.keep_alive() ? std::move(conn) : nullptr);
+            return res;
+        } catch (beast::system_error& e) {
+            // a reused connection may have been closed by the server while it was idle, which is no reason to give up.
+            // a new connection gets one more chance with freshly resolved endpoints.
+            if (fresh) {
+                if (refreshed) {
+                    throw;
+                }
+                refreshed = true;
+            }
+            log::debug("http") << "Retrying request on a new connection: " << e.what();
+        }
+    }
+}
+
+auto connection_pool::open() const -> std::size_t
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    return m_open;
+}
+
+auto connection_pool::acquire(bool& fresh) -> std::unique_ptr<connection>
+{
+    std::unique_lock<std::mutex> lock { m_mutex };
+    m_released.wait(lock, [this] { return !m_idle.empty() || (m_open < m_config.max_connections); });
+    if (!m_idle.empty()) {
+        auto conn { std::move(m_idle.back()) };
+        m_idle.pop_back();
+        fresh = false;
+        return conn;
+    }
+    m_open++;
+    fresh = true;
+    return std::make_unique<connection>();
+}
+
+void connection_pool::release(std::unique_ptr<connection> conn)
+{
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        if (conn != nullptr) {
+            m_idle.emplace_back(std::move(conn));
+        } else {
+            m_open--;
+        }
+    }
+    m_released.notify_one();
+}
+
+auto connection_pool::endpoints(bool refresh) -> tcp::resolver::results_type
+{
+    std::scoped_lock<std::mutex> lock { m_resolve_mutex };
+    const auto now { std::chrono::steady_clock::now() };
+    if (refresh || m_endpoints.empty() || ((now - m_resolved) > m_config.resolve_interval)) {
+        tcp::resolver resolver { m_ioc };
+        m_endpoints = resolver.resolve(m_config.host, std::to_string(m_config.port));
+        m_resolved = now;
+    }
+    return m_endpoints;
+}
+
 } // namespace muonpi::http
@@ -1,17 +1,152 @@
 #include "muonpi/http_server.h"
 #include "muonpi/base64.h"
 #include "muonpi/log.h"
+#include "muonpi/metrics.h"
 #include "muonpi/scopeguard.h"
 
 #include "detail/http_session.hpp"
 
-#include <sstream>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 
 namespace muonpi::http {
 
+namespace {
+    /**
+     * @brief next_segment Separates the first segment of a path, skipping empty segments
+     * @param path The path, gets set to the part after the segment, starting with its separator
+     */
+    [[nodiscard]] auto next_segment(std::string_view& path) -> std::string_view
+    {
+        const auto start { path.find_first_not_of('/') };
+        if (start == std::string_view::npos) {
+            path = {};
+            return {};
+        }
+        path.remove_prefix(start);
+        const auto end { std::min(path.find('/'), path.size()) };
+        const std::string_view segment { path.substr(0, end) };
+        path.remove_prefix(end);
+        return segment;
+    }
+
+    [[nodiscard]] auto only_separators(std::string_view path) -> bool
+    {
+        return path.find_first_not_of('/') == std::string_view::npos;
+    }
+
+    [[nodiscard]] auto is_parameter(std::string_view segment) -> bool
+    {
+        return (segment.size() > 2) && (segment.front() == '{') && (segment.back() == '}');
+    }
+}
+
+struct http_server::endpoint {
+    path_handler handler {};
+    std::vector<std::string> parameters {};
+    std::unique_ptr<node> children {};
+};
+
+struct http_server::node {
+    std::map<std::string, std::unique_ptr<node>, std::less<>> children {};
+    std::unique_ptr<node> parameter {};
+    std::unique_ptr<endpoint> target {};
+    std::unique_ptr<endpoint> wildcard {};
+    std::vector<std::unique_ptr<endpoint>> predicates {};
+
+    [[nodiscard]] inline auto empty() const -> bool
+    {
+        return children.empty() && (parameter == nullptr) && (target == nullptr) && (wildcard == nullptr) && predicates.empty();
+    }
+};
+
+path_view::path_view(std::string_view remaining)
+    : m_remaining { trim(remaining) }
+{
+}
+
+auto path_view::trim(std::string_view path) -> std::string_view
+{
+    if (!path.empty() && (path.front() == '/')) {
+        path.remove_prefix(1);
+    }
+    // a trailing separator does not start another segment
+    if (!path.empty() && (path.back() == '/')) {
+        path.remove_suffix(1);
+    }
+    return path;
+}
+
+auto path_view::empty() const -> bool
+{
+    return m_remaining.empty();
+}
+
+auto path_view::size() const -> std::size_t
+{
+    if (m_remaining.empty()) {
+        return 0;
+    }
+    return static_cast<std::size_t>(std::count(m_remaining.begin(), m_remaining.end(), '/')) + 1;
+}
+
+auto path_view::front() const -> std::string_view
+{
+    return m_remaining.substr(0, m_remaining.find('/'));
+}
+
+auto path_view::operator[](std::size_t index) const -> std::string_view
+{
+    std::size_t start { 0 };
+    for (; index > 0; index--) {
+        start = m_remaining.find('/', start) + 1;
+    }
+    return m_remaining.substr(start, m_remaining.find('/', start) - start);
+}
+
+auto path_view::remaining() const -> std::string_view
+{
+    return m_remaining;
+}
+
+auto path_view::parameter(std::string_view name) const -> std::string_view
+{
+    for (std::size_t i { 0 }; i < m_parameter_count; i++) {
+        if (m_parameters[i].first == name) {
+            return m_parameters[i].second;
+        }
+    }
+    return {};
+}
+
+path_view::operator std::queue<std::string>() const
+{
+    std::queue<std::string> segments {};
+    for (std::size_t i { 0 }; i < size(); i++) {
+        segments.emplace((*this)[i]);
+    }
+    return segments;
+}
+
+auto metrics_handler(std::string name) -> path_handler
+{
+    path_handler handler {};
+    handler.path = name;
+    handler.handle = [](request_type& req, const path_view& /*path*/) {
+        return http_response<http_status::ok>(req, http_response<http_status::ok>::content_type::json)(metrics::registry::instance().to_json());
+    };
+    handler.name = std::move(name);
+    return handler;
+}
+
 http_server::http_server(configuration config)
     : thread_runner("http", true)
+    , m_routes { std::make_unique<node>() }
+    , m_ioc { static_cast<int>(std::max<std::size_t>(config.threads, 1)) }
     , m_endpoint { net::ip::make_address(config.address), static_cast<std::uint16_t>(config.port) }
     , m_conf { std::move(config) }
 {
@@ -53,34 +188,172 @@ http_server::http_server(configuration config)
     start();
 }
 
+http_server::~http_server()
+{
+    finish();
+}
+
 void http_server::add_handler(path_handler han)
 {
-    m_handler.emplace_back(std::move(han));
+    // nothing gets added before the whole tree is known to be valid, so a malformed child leaves the routes as they were
+    validate(han, 0);
+    std::unique_lock lock { m_routes_mutex };
+    compile(*m_routes, std::move(han));
+}
+
+void http_server::validate(const path_handler& handler, std::size_t parameters)
+{
+    if (handler.path.empty()) {
+        if (!handler.matches) {
+            throw std::invalid_argument { "Handler '" + handler.name + "' has neither a path nor a match predicate." };
+        }
+    } else {
+        std::string_view path { handler.path };
+        for (std::string_view segment { next_segment(path) }; !segment.empty(); segment = next_segment(path)) {
+            if (segment == "*") {
+                if (!only_separators(path) || !handler.children.empty()) {
+                    throw std::invalid_argument { "Handler path '" + handler.path + "': a wildcard has to be the last segment and cannot have children." };
+                }
+                break;
+            }
+            if (is_parameter(segment) && (++parameters > path_view::s_max_parameters)) {
+                throw std::invalid_argument { "Handler path '" + handler.path + "' has too many parameters." };
+            }
+        }
+    }
+    for (const auto& child : handler.children) {
+        validate(child, parameters);
+    }
+}
+
+void http_server::compile(node& level, path_handler handler)
+{
+    auto target { std::make_unique<endpoint>() };
+    std::vector<path_handler> children { std::move(handler.children) };
+    handler.children.clear();
+
+    std::unique_ptr<endpoint>* slot { nullptr };
+    if (!handler.path.empty()) {
+        node* current { &level };
+        std::string_view path { handler.path };
+        for (std::string_view segment { next_segment(path) }; !segment.empty(); segment = next_segment(path)) {
+            if (segment == "*") {
+                slot = &current->wildcard;
+                break;
+            }
+            if (is_parameter(segment)) {
+                target->parameters.emplace_back(segment.substr(1, segment.size() - 2));
+                if (current->parameter == nullptr) {
+                    current->parameter = std::make_unique<node>();
+                }
+                current = current->parameter.get();
+                continue;
+            }
+            auto it { current->children.find(segment) };
+            if (it == current->children.end()) {
+                it = current->children.emplace(std::string { segment }, std::make_unique<node>()).first;
+            }
+            current = it->second.get();
+        }
+        if (slot == nullptr) {
+            slot = &current->target;
+        }
+    }
+    if ((slot != nullptr) && (*slot != nullptr)) {
+        log::warning("http") << "Handler '" << handler.name << "' replaces '" << (*slot)->handler.name << "'.";
+    }
+
+    if (!children.empty()) {
+        target->children = std::make_unique<node>();
+        for (auto& child : children) {
+            compile(*target->children, std::move(child));
+        }
+    }
+    target->handler = std::move(handler);
+    if (slot == nullptr) {
+        level.predicates.emplace_back(std::move(target));
+    } else {
+        *slot = std::move(target);
+    }
+}
+
+auto http_server::find(const node& current, std::string_view& path, path_view& view) -> const endpoint*
+{
+    std::string_view rest { path };
+    const std::string_view segment { next_segment(rest) };
+    if (segment.empty()) {
+        return (current.target != nullptr) ? current.target.get() : current.wildcard.get();
+    }
+    // longer routes win, so everything consuming the segment gets tried before the endpoint of this node
+    if (const auto it { current.children.find(segment) }; it != current.children.end()) {
+        std::string_view remaining { rest };
+        if (const endpoint* found { find(*it->second, remaining, view) }; found != nullptr) {
+            path = remaining;
+            return found;
+        }
+    }
+    if (current.parameter != nullptr) {
+        const std::size_t count { view.m_parameter_count };
+        view.m_parameters[view.m_parameter_count++].second = segment;
+        std::string_view remaining { rest };
+        if (const endpoint* found { find(*current.parameter, remaining, view) }; found != nullptr) {
+            path = remaining;
+            return found;
+        }
+        view.m_parameter_count = count;
+    }
+    if (current.wildcard != nullptr) {
+        return current.wildcard.get();
+    }
+    for (const auto& predicate : current.predicates) {
+        if (predicate->handler.matches(segment)) {
+            path = rest;
+            return predicate.get();
+        }
+    }
+    return current.target.get();
 }
 
 auto http_server::custom_run() -> int
 {
     do_accept();
+
+    // the thread of the runner is one of the workers
+    std::vector<std::thread> workers {};
+    scope_guard joined { [this, &workers] {
+        // if one worker fails, the others are stopped as well, so the server does not keep running with fewer threads
+        m_ioc.stop();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    } };
+    for (std::size_t i { 1 }; i < m_conf.threads; i++) {
+        workers.emplace_back([this] {
+            try {
+                m_ioc.run();
+            } catch (std::exception& e) {
+                log::error("http") << "Worker got an uncaught exception: " << e.what();
+                m_ioc.stop();
+            } catch (...) {
+                log::error("http") << "Worker got an uncaught exception.";
+                m_ioc.stop();
+            }
+        });
+    }
     m_ioc.run();
     return 0;
 }
 
 void http_server::do_accept()
 {
-    m_acceptor.async_accept([&](const beast::error_code& ec, tcp::socket socket) {
+    // every connection gets its own strand, so its handlers never run concurrently
+    m_acceptor.async_accept(net::make_strand(m_ioc), [this](const beast::error_code& ec, tcp::socket socket) {
         if (ec) {
             fail(ec, "on accept");
+        } else if (m_conf.ssl) {
+            std::make_shared<detail::session<detail::ssl_stream_t>>(std::move(socket), m_ctx, [this](request_type& req, bool& compress) { return handle(req, compress); }, m_conf.compression)->run();
         } else {
-            std::thread([&] {
-                if (m_conf.ssl) {
-                    detail::session<detail::ssl_stream_t> sess { std::move(socket), m_ctx, [&](request_type req) { return handle(std::move(req)); } };
-                    sess.run();
-                } else {
-                    detail::session<detail::tcp_stream_t> sess { std::move(socket), [&](request_type req) { return handle(std::move(req)); } };
-                    sess.run();
-                }
-            }).detach();
-            std::this_thread::sleep_for(std::chrono::milliseconds { 2 });
+            std::make_shared<detail::session<detail::tcp_stream_t>>(std::move(socket), [this](request_type& req, bool& compress) { return handle(req, compress); }, m_conf.compression)->run();
         }
         do_accept();
     });
@@ -91,72 +364,65 @@ void http_server::on_stop()
     m_ioc.stop();
 }
 
-auto http_server::handle(request_type req) const -> response_type
+auto http_server::handle(request_type& req, bool& compress) const -> any_response
 {
     if (req.target().empty() || req.target()[0] != '/' || (req.target().find("..") != beast::string_view::npos)) {
         return http_response<beast::http::status::bad_request>(req)("Malformed request-target");
     }
-    if (m_handler.empty()) {
+    // the lock is held until the handler returned, since the routes own the handlers
+    std::shared_lock lock { m_routes_mutex };
+    if (m_routes->empty()) {
         return http_response<beast::http::status::service_unavailable>(req)("No handler installed");
     }
 
-    std::queue<std::string> path {};
-    {
-        std::istringstream stream { req.target().to_string() };
-        for (std::string part; std::getline(stream, part, '/');) {
-            path.emplace(part);
+    std::string_view path { req.target().data(), req.target().size() };
+    path_view view {};
+    const node* level { m_routes.get() };
+    while (true) {
+        if (only_separators(path)) {
+            return http_response<beast::http::status::bad_request>(req)("Request-target empty");
         }
-    }
-
-    return handle(std::move(req), std::move(path), m_handler);
-}
-
-auto http_server::handle(request_type req, std::queue<std::string> path, const std::vector<path_handler>& handlers) const -> response_type
-{
-    while (!path.empty() && path.front().empty()) {
-        path.pop();
-    }
-
-    if (path.empty()) {
-        return http_response<beast::http::status::bad_request>(req)("Request-target empty");
-    }
-
-    for (const auto& hand : handlers) {
-        if (hand.matches(path.front())) {
-            return handle(req, path, hand);
+        const std::size_t captured { view.m_parameter_count };
+        const endpoint* target { find(*level, path, view) };
+        if (target == nullptr) {
+            return http_response<beast::http::status::bad_request>(req)("Illegal request-target");
         }
-    }
-    return http_response<beast::http::status::bad_request>(req)("Illegal request-target");
-}
+        for (std::size_t i { 0 }; i < target->parameters.size(); i++) {
+            view.m_parameters[captured + i].first = target->parameters[i];
+        }
+        const path_handler& hand { target->handler };
 
-auto http_server::handle(request_type req, std::queue<std::string> path, const path_handler& hand) const -> response_type
-{
-    path.pop();
+        if (hand.requires_auth) {
+            std::string auth { req[beast::http::field::authorization] };
 
-    if (hand.requires_auth) {
-        std::string auth { req[beast::http::field::authorization] };
+            constexpr std::string_view scheme { "Basic " };
 
-        if (auth.empty()) {
-            return http_response<beast::http::status::unauthorized>(req)("Need authorisation");
-        }
-        constexpr std::size_t header_length { 6 };
+            if (auth.compare(0, scheme.size(), scheme) != 0) {
+                return http_response<beast::http::status::unauthorized>(req)("Need authorisation");
+            }
 
-        auth = base64::decode(auth.substr(header_length));
+            auth = base64::decode(auth.substr(scheme.size()));
 
-        auto delimiter = auth.find_first_of(':');
-        auto username = auth.substr(0, delimiter);
-        auto password = auth.substr(delimiter + 1);
+            auto delimiter = auth.find_first_of(':');
+            auto username = auth.substr(0, delimiter);
+            auto password = auth.substr(delimiter + 1);
 
-        if (!hand.authenticate(req, username, password)) {
-            return http_response<beast::http::status::unauthorized>(req)("Authorisation failed for user: '" + username + "'");
+            if (!hand.authenticate(req, username, password)) {
+                return http_response<beast::http::status::unauthorized>(req)("Authorisation failed for user: '" + username + "'");
+            }
         }
-    }
 
-    if (hand.children.empty() || path.empty()) {
-        return hand.handle(req, path);
+        if ((target->children == nullptr) || only_separators(path)) {
+            view.m_remaining = path_view::trim(path);
+            compress = compress && hand.compress;
+            if (hand.cache != nullptr) {
+                // the cache compresses the responses itself, so revalidations get the same headers as the full responses
+                return hand.cache->serve(req, [&] { return hand.handle(req, view); }, compress ? &m_conf.compression : nullptr);
+            }
+            return hand.handle(req, view);
+        }
+        level = target->children.get();
     }
-
-    return handle(std::move(req), std::move(path), hand.children);
 }
 
 } // namespace muonpi::http
@@ -1,7 +1,21 @@
 #include "muonpi/http_tools.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <zlib.h>
+
 namespace muonpi::http {
 
+namespace {
+    constexpr int s_min_window_bits { 9 };
+    constexpr int s_max_window_bits { 15 };
+    constexpr std::size_t s_min_lookahead { 262 };
+    constexpr int s_gzip_header { 16 };
+    constexpr int s_memory_level { 8 };
+}
+
 void fail(beast::error_code ec, const std::string& what)
 {
     if (ec == net::ssl::error::stream_truncated) {
@@ -11,4 +25,133 @@ void fail(beast::error_code ec, const std::string& what)
     log::warning() << what << ": " << ec.message();
 }
 
+auto compress(std::string_view data, Coding coding, int level) -> std::string
+{
+    z_stream stream {};
+    // a window larger than the data gains nothing, but its allocation dominates the time for small bodies
+    int window { s_min_window_bits };
+    while ((window < s_max_window_bits) && ((std::size_t { 1 } << static_cast<unsigned>(window)) < (data.size() + s_min_lookahead))) {
+        window++;
+    }
+    if (coding == Coding::Gzip) {
+        window += s_gzip_header;
+    }
+    if (deflateInit2(&stream, level, Z_DEFLATED, window, s_memory_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error { "Could not initialise compression." };
+    }
+    std::string output {};
+    output.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(output.data());
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    // the output was sized with deflateBound, so a single call finishes the stream
+    const int result { deflate(&stream, Z_FINISH) };
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error { "Could not compress data." };
+    }
+    return output;
+}
+
+auto coding_name(Coding coding) -> std::string_view
+{
+    switch (coding) {
+    case Coding::Gzip:
+        return "gzip";
+    case Coding::Deflate:
+        return "deflate";
+    }
+    return {};
+}
+
+auto accepted_coding(std::string_view accept_encoding) -> std::optional<Coding>
+{
+    // the quality of gzip, deflate and the wildcard, -1 if not mentioned
+    double gzip { -1.0 };
+    double deflate { -1.0 };
+    double any { -1.0 };
+    while (!accept_encoding.empty()) {
+        const auto end { std::min(accept_encoding.find(','), accept_encoding.size()) };
+        std::string_view element { accept_encoding.substr(0, end) };
+        accept_encoding.remove_prefix(std::min(end + 1, accept_encoding.size()));
+
+        double quality { 1.0 };
+        if (const auto parameter { element.find(';') }; parameter != std::string_view::npos) {
+            const auto q { element.find("q=", parameter) };
+            if (q != std::string_view::npos) {
+                quality = std::strtod(std::string { element.substr(q + 2) }.c_str(), nullptr);
+            }
+            element = element.substr(0, parameter);
+        }
+        const auto first { element.find_first_not_of(' ') };
+        if (first == std::string_view::npos) {
+            continue;
+        }
+        element = element.substr(first, element.find_last_not_of(' ') - first + 1);
+        if ((element == "gzip") || (element == "x-gzip")) {
+            gzip = quality;
+        } else if (element == "deflate") {
+            deflate = quality;
+        } else if (element == "*") {
+            any = quality;
+        }
+    }
+    if (gzip < 0.0) {
+        gzip = any;
+    }
+    if (deflate < 0.0) {
+        deflate = any;
+    }
+    if ((gzip > 0.0) && (gzip >= deflate)) {
+        return Coding::Gzip;
+    }
+    if (deflate > 0.0) {
+        return Coding::Deflate;
+    }
+    return std::nullopt;
+}
+
+void compress_response(response_type& response, std::string_view accept_encoding, const compression_t& compression)
+{
+    if (!compression.enabled || (response.body().size() < compression.min_bytes) || (response.count(http_field::content_encoding) > 0)) {
+        return;
+    }
+    const auto vary { response[http_field::vary] };
+    for (const auto& token : beast::http::token_list { vary }) {
+        if (beast::iequals(token, "accept-encoding")) {
+            // negotiated already
+            return;
+        }
+    }
+    const auto type { response[http_field::content_type] };
+    const bool textual { type.starts_with("text/") || (type.find("json") != beast::string_view::npos) || (type.find("xml") != beast::string_view::npos) || (type.find("javascript") != beast::string_view::npos) };
+    if (!textual) {
+        return;
+    }
+    // the representation depends on the request from here on, even if this one does not get compressed
+    response.set(http_field::vary, vary.empty() ? std::string { "Accept-Encoding" } : (std::string { vary } + ", Accept-Encoding"));
+
+    const auto coding { accepted_coding(accept_encoding) };
+    if (!coding.has_value()) {
+        return;
+    }
+    std::string compressed { compress(response.body(), *coding, compression.level) };
+    if (compressed.size() >= response.body().size()) {
+        return;
+    }
+    response.body() = std::move(compressed);
+    const std::string_view name { coding_name(*coding) };
+    response.set(http_field::content_encoding, beast::string_view { name.data(), name.size() });
+    // the encoded body differs byte by byte, so an ETag of the plain body only stays valid as a weak one
+    const auto tag { response[http_field::etag] };
+    if (!tag.empty() && !tag.starts_with("W/")) {
+        response.set(http_field::etag, "W/" + std::string { tag });
+    }
+    response.prepare_payload();
+}
+
 } // namespace muonpi::http
@@ -1,57 +1,106 @@
 #include "muonpi/link/influx.h"
 #include "muonpi/http_request.h"
+#include "muonpi/http_tools.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 namespace muonpi::link {
 
+namespace {
+    constexpr std::size_t s_line_reserve { 256 };
+}
+
 influx::entry::entry(const std::string& measurement, influx& link)
-    : m_link { link }
+    : m_buffer { acquire() }
+    , m_link { link }
 {
-    m_tags << measurement;
+    escape(measurement, s_measurement_special, m_buffer->tags);
+}
+
+influx::entry::~entry()
+{
+    if (m_buffer != nullptr) {
+        release(std::move(m_buffer));
+    }
 }
 
 auto influx::entry::operator<<(const tag& tag) -> entry&
 {
-    m_tags << ',' << tag.name << '=' << tag.value;
+    std::string& tags { m_buffer->tags };
+    tags.push_back(',');
+    escape(tag.name, s_name_special, tags);
+    tags.push_back('=');
+    escape(tag.value, s_name_special, tags);
     return *this;
 }
 
 auto influx::entry::commit(std::int_fast64_t timestamp) -> bool
 {
-    if (m_fields.str().empty()) {
+    if (m_buffer->fields.empty()) {
         return false;
     }
-    m_tags << ' '
-           << m_fields.str().substr(1)
-           << ' ' << timestamp;
-    return m_link.send_string(m_tags.str());
+    std::string& line { m_buffer->tags };
+    const std::size_t tags_end { line.size() };
+    line.push_back(' ');
+    line.append(m_buffer->fields);
+    line.push_back(' ');
+    append_number(timestamp, line);
+    const bool queued { m_link.enqueue(line) };
+    line.resize(tags_end);
+    return queued;
 }
 
-influx::influx(configuration config)
-    : m_config { std::move(config) }
+void influx::entry::escape(std::string_view text, std::string_view special, std::string& out)
 {
+    std::size_t start { 0 };
+    for (;;) {
+        const auto position { text.find_first_of(special, start) };
+        if (position == std::string_view::npos) {
+            out.append(text.substr(start));
+            return;
+        }
+        out.append(text.substr(start, position - start));
+        out.push_back('\\');
+        out.push_back(text[position]);
+        start = position + 1;
+    }
 }
 
-influx::influx() = default;
-
-influx::~influx() = default;
-
-auto influx::measurement(const std::string& measurement) -> entry
+auto influx::entry::pool() -> std::vector<std::unique_ptr<buffer_t>>&
 {
-    return entry { measurement, *this };
+    thread_local std::vector<std::unique_ptr<buffer_t>> buffers {};
+    return buffers;
 }
 
-auto influx::send_string(const std::string& query) const -> bool
+auto influx::entry::acquire() -> std::unique_ptr<buffer_t>
 {
-    http::destination_t destination {};
+    auto& buffers { pool() };
+    if (buffers.empty()) {
+        auto buffer { std::make_unique<buffer_t>() };
+        buffer->tags.reserve(s_line_reserve);
+        buffer->fields.reserve(s_line_reserve);
+        return buffer;
+    }
+    auto buffer { std::move(buffers.back()) };
+    buffers.pop_back();
+    return buffer;
+}
 
-    destination.host = m_config.host;
-    destination.method = http::http_verb::post;
-    destination.port = s_port;
+void influx::entry::release(std::unique_ptr<buffer_t> buffer)
+{
+    buffer->tags.clear();
+    buffer->fields.clear();
+    pool().emplace_back(std::move(buffer));
+}
 
+influx::influx(configuration config)
+    : thread_runner { "muon::influx" }
+    , m_config { std::move(config) }
+{
     std::ostringstream target {};
     target
         << "/write?db="
@@ -59,21 +108,176 @@ auto influx::send_string(const std::string& query) const -> bool
         << "&u=" << m_config.login.username
         << "&p=" << m_config.login.password
         << "&epoch=ms";
+    m_target = target.str();
 
-    destination.target = target.str();
+    m_pool = std::make_unique<http::connection_pool>(http::connection_pool::configuration { m_config.host, s_port, m_config.connections });
+    m_config.batch.max_bytes = std::max<std::size_t>(m_config.batch.max_bytes, 1);
+
+    start();
+}
+
+influx::influx()
+    : influx { configuration {} }
+{
+}
+
+influx::~influx()
+{
+    finish();
+}
+
+auto influx::measurement(const std::string& measurement) -> entry
+{
+    return entry { measurement, *this };
+}
+
+void influx::flush()
+{
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        m_flush = true;
+    }
+    m_wakeup.notify();
+}
 
-    std::vector<http::field_t> fields {
+auto influx::dropped() const -> std::size_t
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    return m_dropped;
+}
+
+auto influx::enqueue(std::string_view line) -> bool
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    if ((m_buffer.size() + m_sending_bytes + line.size() + 1) > m_config.batch.max_buffer_bytes) {
+        m_dropped++;
+        return false;
+    }
+    m_buffer.append(line);
+    m_buffer.push_back('\n');
+    m_lines++;
+    if (!m_flush && ((m_lines >= m_config.batch.max_lines) || (m_buffer.size() >= m_config.batch.max_bytes))) {
+        m_flush = true;
+        m_wakeup.notify();
+    }
+    return true;
+}
+
+auto influx::step() -> int
+{
+    static_cast<void>(m_wakeup.wait_for(m_failing ? m_config.batch.retry_interval : m_config.batch.linger));
+    if (m_quit) {
+        return 0;
+    }
+    bool requested { false };
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        requested = m_flush;
+    }
+    const auto now { std::chrono::steady_clock::now() };
+    if (m_failing && !requested && ((now - m_last_attempt) < m_config.batch.retry_interval)) {
+        return 0;
+    }
+    m_last_attempt = now;
+    m_failing = !write_pending();
+    return 0;
+}
+
+auto influx::post_run() -> int
+{
+    if (!write_pending()) {
+        log::warning("influx") << "Could not write " << m_sending.size() << " bytes of remaining entries.";
+    }
+    return 0;
+}
+
+void influx::on_stop()
+{
+    m_wakeup.notify();
+}
+
+auto influx::write_pending() -> bool
+{
+    {
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        m_flush = false;
+        m_sending.append(m_buffer);
+        m_buffer.clear();
+        m_lines = 0;
+        m_sending_bytes = m_sending.size();
+    }
+    std::size_t offset { 0 };
+    bool success { true };
+    std::size_t rejected { 0 };
+    std::size_t limit { m_config.batch.max_bytes };
+    while (offset < m_sending.size()) {
+        // batches end on a line boundary, a single line larger than the limit is sent on its own
+        std::size_t end { m_sending.size() };
+        if ((end - offset) > limit) {
+            const auto last { m_sending.rfind('\n', offset + limit - 1) };
+            end = ((last == std::string::npos) || (last < offset)) ? (m_sending.find('\n', offset) + 1) : (last + 1);
+        }
+        Result result { send_string(m_sending.substr(offset, end - offset)) };
+        const auto lines { static_cast<std::size_t>(std::count(m_sending.begin() + static_cast<std::ptrdiff_t>(offset), m_sending.begin() + static_cast<std::ptrdiff_t>(end), '\n')) };
+        if (result == Result::TooLarge) {
+            if (lines > 1) {
+                // the rest of this write goes out in batches no larger than half of the refused one
+                limit = std::max<std::size_t>((end - offset) / 2, 1);
+                continue;
+            }
+            log::warning("influx") << "Dropping a line of " << (end - offset) << " bytes which the database refuses as too large.";
+            result = Result::Rejected;
+        }
+        if (result == Result::Failed) {
+            success = false;
+            break;
+        }
+        if (result == Result::Rejected) {
+            rejected += lines;
+        }
+        offset = end;
+    }
+    m_sending.erase(0, offset);
+
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    m_sending_bytes = m_sending.size();
+    m_dropped += rejected;
+    return success;
+}
+
+auto influx::send_string(const std::string& query) -> Result
+{
+    static const std::vector<http::field_t> fields {
         { http::http_field::content_type, "application/x-www-form-urlencoded" },
         { http::http_field::accept, "*/*" }
     };
+    static const std::vector<http::field_t> compressed_fields {
+        { http::http_field::content_type, "application/x-www-form-urlencoded" },
+        { http::http_field::accept, "*/*" },
+        { http::http_field::content_encoding, "gzip" }
+    };
 
-    auto res = http::http_request(destination, query, false, fields);
+    try {
+        const bool compress { m_config.compression.enabled && (query.size() >= m_config.compression.min_bytes) };
+        auto res { compress
+                ? m_pool->request(http::http_verb::post, m_target, http::compress(query, http::Coding::Gzip, m_config.compression.level), compressed_fields)
+                : m_pool->request(http::http_verb::post, m_target, query, fields) };
 
-    if (res.result() != http::http_status::no_content) {
+        if (res.result() == http::http_status::no_content) {
+            return Result::Written;
+        }
         log::warning() << "Couldn't write to database: " << std::to_string(static_cast<unsigned>(res.result())) << ": " << res.body();
-        return false;
+        // the database refuses malformed data, sending it again would not help
+        if (res.result() == http::http_status::bad_request) {
+            return Result::Rejected;
+        }
+        if (res.result() == http::http_status::payload_too_large) {
+            return Result::TooLarge;
+        }
+    } catch (std::exception& e) {
+        log::warning() << "Couldn't write to database: " << e.what();
     }
-    return true;
+    return Result::Failed;
 }
 
 } // namespace muonpi::link
@@ -2,31 +2,75 @@
 #include "muonpi/exceptions.h"
 #include "muonpi/log.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstring>
 #include <functional>
+#include <limits>
+#include <poll.h>
 #include <regex>
 #include <sstream>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <utility>
 
 namespace muonpi::link {
 
-constexpr std::chrono::duration s_timeout { std::chrono::milliseconds { 10 } };
+constexpr std::chrono::microseconds s_replay_interval { std::chrono::milliseconds { 10 } };
+
+namespace {
+    constexpr std::string_view s_share_prefix { "$share/" };
+
+    /**
+     * @brief subscription_filter The filter incoming topics are matched against.
+     * For shared subscriptions this is the part after '$share/<group>/'.
+     */
+    [[nodiscard]] auto subscription_filter(std::string_view topic) -> std::string_view
+    {
+        if (topic.substr(0, s_share_prefix.size()) != s_share_prefix) {
+            return topic;
+        }
+        const auto separator { topic.find('/', s_share_prefix.size()) };
+        if (separator == std::string_view::npos) {
+            return topic;
+        }
+        return topic.substr(separator + 1);
+    }
+
+    [[nodiscard]] auto spool_options(const mqtt::publish_options_t& options) -> spool::options_t
+    {
+        return spool::options_t { static_cast<std::uint8_t>(options.qos), options.retain };
+    }
+}
 
 auto mqtt::wait_for(Status status, std::chrono::milliseconds duration) -> bool
 {
-    std::chrono::steady_clock::time_point start { std::chrono::steady_clock::now() };
-    while (((std::chrono::steady_clock::now() - start) < duration)) {
-        if (m_status == status) {
-            return true;
-        }
-        std::this_thread::sleep_for(s_timeout);
+    std::unique_lock<std::mutex> lock { m_status_mutex };
+    return m_status_condition.wait_for(lock, duration, [this, status] { return m_status == status; });
+}
+
+auto mqtt::statistics() const -> statistics_t
+{
+    std::scoped_lock<std::mutex> lock { m_status_mutex };
+    auto downtime { m_downtime };
+    if (m_disconnected_since.has_value()) {
+        downtime += std::chrono::steady_clock::now() - *m_disconnected_since;
     }
-    return false;
+    return statistics_t { m_reconnects, m_attempts, std::chrono::duration_cast<std::chrono::milliseconds>(downtime) };
 }
 
 void wrapper_callback_connected(mosquitto* /*mqtt*/, void* object, int result)
 {
-    static_cast<mqtt*>(object)->callback_connected(result);
+    static_cast<mqtt*>(object)->callback_connected(result, 0);
+}
+
+void wrapper_callback_connected_v5(mosquitto* /*mqtt*/, void* object, int result, int /*flags*/, const mosquitto_property* properties)
+{
+    // a broker which does not send the property does not accept any topic aliases
+    std::uint16_t alias_maximum { 0 };
+    static_cast<void>(mosquitto_property_read_int16(properties, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &alias_maximum, false));
+    static_cast<mqtt*>(object)->callback_connected(result, alias_maximum);
 }
 
 void wrapper_callback_disconnected(mosquitto* /*mqtt*/, void* object, int result)
@@ -44,8 +88,27 @@ mqtt::mqtt(configuration config, std::string station_id, const std::string& name
     , m_config { std::move(config) }
     , m_station_id { std::move(station_id) }
     , m_mqtt { init(client_id().c_str()) }
+    , m_outbound { std::make_unique<lockfree_queue<outbound_message_t>>(m_config.outbound.capacity) }
+    , m_wakeup_fd { ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
 {
-    mosquitto_connect_callback_set(m_mqtt, wrapper_callback_connected);
+    // the mqtt thread drives the network loop itself, other threads only queue packets
+    mosquitto_threaded_set(m_mqtt, true);
+    if (m_config.mqtt5 && (mosquitto_int_option(m_mqtt, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5) != MOSQ_ERR_SUCCESS)) {
+        log::warning("mqtt") << "Could not select mqtt 5, continuing with 3.1.1.";
+        m_config.mqtt5 = false;
+    }
+    if (!m_config.offline_spool.directory.empty()) {
+        try {
+            m_spool = std::make_unique<spool>(m_config.offline_spool);
+        } catch (std::exception& e) {
+            log::error("mqtt") << "Could not open the spool, continuing without: " << e.what();
+        }
+    }
+    if (m_config.mqtt5) {
+        mosquitto_connect_v5_callback_set(m_mqtt, wrapper_callback_connected_v5);
+    } else {
+        mosquitto_connect_callback_set(m_mqtt, wrapper_callback_connected);
+    }
     mosquitto_disconnect_callback_set(m_mqtt, wrapper_callback_disconnected);
     mosquitto_message_callback_set(m_mqtt, wrapper_callback_message);
 
@@ -56,18 +119,23 @@ mqtt::mqtt(std::string station_id, const std::string& name)
     : thread_runner { name }
     , m_station_id { std::move(station_id) }
     , m_mqtt { init(client_id().c_str()) }
+    , m_outbound { std::make_unique<lockfree_queue<outbound_message_t>>(m_config.outbound.capacity) }
+    , m_wakeup_fd { ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
 {
 }
 
 mqtt::~mqtt()
-    = default;
+{
+    if (m_wakeup_fd >= 0) {
+        ::close(m_wakeup_fd);
+    }
+}
 
 auto mqtt::pre_run() -> int
 {
-    if (m_mqtt == nullptr) {
+    if ((m_mqtt == nullptr) || (m_wakeup_fd < 0)) {
         return -1;
     }
-    mosquitto_loop_start(m_mqtt);
     if (!connect()) {
         return -1;
     }
@@ -79,33 +147,137 @@ auto mqtt::pre_run() -> int
 
 auto mqtt::step() -> int
 {
-    std::mutex mx;
-    std::unique_lock<std::mutex> lock { mx };
-    m_condition.wait(lock);
-    if (!m_quit) {
+    if (!m_reconnect) {
+        // everything else that needs the thread wakes it, only a rate limited replay has to poll.
+        // waking up four times per keepalive interval sends the pings in time.
+        const bool backlog { (m_spool != nullptr) && (m_status == Status::Connected) && !m_spool->empty() };
+        const std::chrono::microseconds idle { std::chrono::seconds { std::max(m_config.keepalive / 4, 1) } };
+        service(backlog ? s_replay_interval : idle);
+    }
+    if (m_quit) {
+        return 0;
+    }
+    if (m_reconnect.exchange(false)) {
         if (!connect()) {
-            return -1;
+            return m_quit ? 0 : -1;
         }
     }
+    if (m_status == Status::Connected) {
+        replay_spool();
+        flush_outbound();
+    }
     return 0;
 }
 
-void mqtt::callback_connected(int result)
+auto mqtt::enqueue(std::string topic, std::string content, const publish_options_t& options) -> bool
 {
-    if (result == 0) {
+    if (!m_outbound->try_push(outbound_message_t { std::move(topic), std::move(content), options })) {
+        return false;
     }
-    if (!m_connect_future.valid()) {
-        return;
+    // only the first message after a drain needs to wake the thread
+    if (!m_outbound_signalled.exchange(true)) {
+        wake();
+    }
+    return true;
+}
+
+void mqtt::wake()
+{
+    if (!m_wakeup_pending.exchange(true)) {
+        const std::uint64_t value { 1 };
+        static_cast<void>(::write(m_wakeup_fd, &value, sizeof(value)));
+    }
+}
+
+void mqtt::service(std::chrono::microseconds timeout)
+{
+    // a wakeup from after this point either writes to the eventfd again or was already taken into account
+    m_wakeup_pending = false;
+    std::uint64_t value {};
+    static_cast<void>(::read(m_wakeup_fd, &value, sizeof(value)));
+    std::array<pollfd, 2> fds {};
+    fds[0] = pollfd { m_wakeup_fd, POLLIN, 0 };
+    const int socket { mosquitto_socket(m_mqtt) };
+    nfds_t count { 1 };
+    if (socket >= 0) {
+        // packets queued by other threads are only written from here, wake() makes sure they are noticed
+        fds[1] = pollfd { socket, static_cast<short>(POLLIN | (mosquitto_want_write(m_mqtt) ? POLLOUT : 0)), 0 };
+        count = 2;
+    }
+    const auto milliseconds { std::chrono::ceil<std::chrono::milliseconds>(std::max(timeout, std::chrono::microseconds { 0 })) };
+    if (::poll(fds.data(), count, static_cast<int>(std::min<std::chrono::milliseconds::rep>(milliseconds.count(), std::numeric_limits<int>::max()))) > 0) {
+        if ((count > 1) && ((fds[1].revents & (POLLIN | POLLERR | POLLHUP)) != 0)) {
+            mosquitto_loop_read(m_mqtt, 1);
+        }
+        if ((count > 1) && ((fds[1].revents & POLLOUT) != 0) && (mosquitto_socket(m_mqtt) >= 0)) {
+            mosquitto_loop_write(m_mqtt, 1);
+        }
+    }
+    // sends pings and notices a broker which stopped answering them
+    mosquitto_loop_misc(m_mqtt);
+}
+
+auto mqtt::service_until(std::chrono::steady_clock::time_point deadline, const std::function<bool()>& done) -> bool
+{
+    while (!done()) {
+        const auto now { std::chrono::steady_clock::now() };
+        if (now >= deadline) {
+            return false;
+        }
+        service(std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+    }
+    return true;
+}
+
+void mqtt::flush_outbound()
+{
+    m_outbound_signalled = false;
+    const auto deadline { std::chrono::steady_clock::now() + m_config.outbound.linger };
+    bool pending { false };
+    for (;;) {
+        auto message { m_outbound->try_pop() };
+        if (!message.has_value()) {
+            const auto now { std::chrono::steady_clock::now() };
+            if (!pending || m_quit || (now >= deadline)) {
+                break;
+            }
+            service(std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+            m_outbound_signalled = false;
+            continue;
+        }
+        auto& batch { m_outbound_batches[message->topic] };
+        batch.content.append(message->content);
+        batch.content.push_back('\n');
+        batch.options = message->options;
+        pending = true;
+        if (batch.content.size() >= m_config.outbound.max_batch_bytes) {
+            static_cast<void>(publish(message->topic, batch.content, batch.options));
+            batch.content.clear();
+        }
+    }
+    for (auto& [topic, batch] : m_outbound_batches) {
+        if (!batch.content.empty()) {
+            static_cast<void>(publish(topic, batch.content, batch.options));
+            batch.content.clear();
+        }
     }
+}
+
+void mqtt::callback_connected(int result, std::uint16_t alias_maximum)
+{
     switch (result) {
     case MOSQ_ERR_SUCCESS:
         log::info("mqtt") << "Connected.";
+        {
+            // aliases only live as long as the connection
+            std::scoped_lock<std::mutex> lock { m_alias_mutex };
+            m_topic_aliases.clear();
+            m_alias_maximum = std::min(m_config.topic_alias_maximum, alias_maximum);
+        }
         set_status(Status::Connected);
-        m_tries = 0;
         for (auto& [topic, sub] : m_subscribers) {
-            p_subscribe(topic);
+            p_subscribe(topic, sub->m_qos);
         }
-        m_connect_promise.set_value(true);
         return;
     case MOSQ_ERR_PROTOCOL:
         log::warning("mqtt") << "Connection failed: Protocol Error";
@@ -124,7 +296,6 @@ void mqtt::callback_connected(int result)
         break;
     };
     set_status(Status::Error);
-    m_connect_promise.set_value(false);
 }
 
 void mqtt::callback_disconnected(int result)
@@ -134,8 +305,8 @@ void mqtt::callback_disconnected(int result)
             return;
         }
         log::warning("mqtt") << "Disconnected unexpectedly: " << result;
-        m_condition.notify_all();
         set_status(Status::Error);
+        m_reconnect = true;
     } else {
         set_status(Status::Disconnected);
     }
@@ -143,31 +314,45 @@ void mqtt::callback_disconnected(int result)
 
 void mqtt::callback_message(const mosquitto_message* message)
 {
-    std::string message_topic { message->topic };
-    std::vector<std::string> messages {};
-    {
-        std::istringstream stream { std::string { static_cast<char*>(message->payload) } };
-        std::string line {};
-        while (std::getline(stream, line, '\n')) {
-            if (!line.empty()) {
-                messages.emplace_back(line);
-            }
+    const std::size_t topic_length { std::strlen(message->topic) };
+    const std::size_t payload_length { (message->payload == nullptr) ? 0 : static_cast<std::size_t>(std::max(message->payloadlen, 0)) };
+
+    // the buffer is only created once a subscriber matches, it holds the topic followed by the payload
+    std::shared_ptr<const std::string> buffer {};
+    m_subscription_trie.match(std::string_view { message->topic, topic_length }, [&](subscriber* sub) {
+        if (buffer == nullptr) {
+            auto data { std::make_shared<std::string>() };
+            data->reserve(topic_length + payload_length);
+            data->append(message->topic, topic_length);
+            data->append(static_cast<const char*>(message->payload), payload_length);
+            buffer = std::move(data);
         }
-    }
-    for (auto& [topic, sub] : m_subscribers) {
-        bool result {};
-        mosquitto_topic_matches_sub2(topic.c_str(), topic.length(), message_topic.c_str(), message_topic.length(), &result);
-        if (!result) {
-            continue;
+        const std::string_view message_topic { buffer->data(), topic_length };
+        sub->push_payload({ message_topic, std::string_view { buffer->data() + topic_length, payload_length }, buffer });
+        if (!sub->wants_lines()) {
+            return;
         }
-        for (const auto& content : messages) {
-            sub->push_message({ message_topic, content });
+        const char* position { buffer->data() + topic_length };
+        const char* const end { position + payload_length };
+        while (position < end) {
+            const auto* newline { static_cast<const char*>(std::memchr(position, '\n', static_cast<std::size_t>(end - position))) };
+            const char* const line_end { (newline == nullptr) ? end : newline };
+            if (line_end > position) {
+                sub->push_message({ message_topic, std::string_view { position, static_cast<std::size_t>(line_end - position) }, buffer });
+            }
+            if (newline == nullptr) {
+                break;
+            }
+            position = newline + 1;
         }
-    }
+    });
 }
 
 auto mqtt::post_run() -> int
 {
+    if (m_status == Status::Connected) {
+        flush_outbound();
+    }
     m_subscribers.clear();
     m_publishers.clear();
 
@@ -175,7 +360,6 @@ auto mqtt::post_run() -> int
         return -1;
     }
     if (m_mqtt != nullptr) {
-        mosquitto_loop_stop(m_mqtt, true);
         mosquitto_destroy(m_mqtt);
         m_mqtt = nullptr;
         mosquitto_lib_cleanup();
@@ -185,32 +369,123 @@ auto mqtt::post_run() -> int
 
 void mqtt::on_stop()
 {
-    m_connect_condition.notify_all();
+    {
+        // waiters check m_quit while holding the mutex, so the notification can not get lost
+        std::scoped_lock<std::mutex> lock { m_status_mutex };
+    }
+    m_status_condition.notify_all();
+    wake();
 }
 
-auto mqtt::publish(const std::string& topic, const std::string& content) -> bool
+auto mqtt::publish(const std::string& topic, const std::string& content, const publish_options_t& options) -> bool
 {
-    if (!check_connection()) {
+    if (options.qos == QoS::AtMostOnce) {
+        // no delivery guarantee, so there is nothing to keep for later
+        if (!check_connection()) {
+            return false;
+        }
+        const bool sent { send(topic, content, options) == MOSQ_ERR_SUCCESS };
+        wake();
+        return sent;
+    }
+    if (m_spool != nullptr) {
+        // live messages go out directly, only the backlog is rate limited. They may overtake spooled messages.
+        if (m_status != Status::Connected) {
+            return m_spool->append(topic, content, spool_options(options));
+        }
+    } else if (!check_connection()) {
         return false;
     }
-    auto result { mosquitto_publish(m_mqtt, nullptr, topic.c_str(), static_cast<int>(content.size()), static_cast<const void*>(content.c_str()), 1, false) };
+    auto result { send(topic, content, options) };
     if (result == MOSQ_ERR_SUCCESS) {
+        wake();
         return true;
     }
     log::warning("mqtt") << "Could not publish message: " << result;
+    if (m_spool != nullptr) {
+        return m_spool->append(topic, content, spool_options(options));
+    }
     return false;
 }
 
+auto mqtt::send(const std::string& topic, const std::string& content, const publish_options_t& options) -> int
+{
+    const auto qos { static_cast<int>(options.qos) };
+    const auto length { static_cast<int>(content.size()) };
+    const auto* payload { static_cast<const void*>(content.c_str()) };
+    // messages with a higher QoS may be sent again after a reconnect, when the broker no longer knows the alias
+    if (!options.topic_alias || !m_config.mqtt5 || (options.qos != QoS::AtMostOnce)) {
+        return mosquitto_publish(m_mqtt, nullptr, topic.c_str(), length, payload, qos, options.retain);
+    }
+
+    // the lock is held while sending, so no message using an alias overtakes the one establishing it
+    std::scoped_lock<std::mutex> lock { m_alias_mutex };
+    auto it { m_topic_aliases.find(topic) };
+    if (it == m_topic_aliases.end()) {
+        if (m_topic_aliases.size() >= m_alias_maximum) {
+            return mosquitto_publish(m_mqtt, nullptr, topic.c_str(), length, payload, qos, options.retain);
+        }
+        it = m_topic_aliases.emplace(topic, topic_alias_t { static_cast<std::uint16_t>(m_topic_aliases.size() + 1), false }).first;
+    }
+    auto& alias { it->second };
+    mosquitto_property* properties { nullptr };
+    if (mosquitto_property_add_int16(&properties, MQTT_PROP_TOPIC_ALIAS, alias.id) != MOSQ_ERR_SUCCESS) {
+        mosquitto_property_free_all(&properties);
+        return mosquitto_publish(m_mqtt, nullptr, topic.c_str(), length, payload, qos, options.retain);
+    }
+    // once the broker knows the alias, the topic is left out
+    const char* topic_name { alias.established ? nullptr : topic.c_str() };
+    const auto result { mosquitto_publish_v5(m_mqtt, nullptr, topic_name, length, payload, qos, options.retain, properties) };
+    mosquitto_property_free_all(&properties);
+    if (result == MOSQ_ERR_SUCCESS) {
+        alias.established = true;
+    }
+    return result;
+}
+
+void mqtt::replay_spool()
+{
+    if ((m_spool == nullptr) || (m_status != Status::Connected) || m_spool->empty()) {
+        m_last_replay = std::chrono::steady_clock::now();
+        return;
+    }
+    std::size_t budget { std::numeric_limits<std::size_t>::max() };
+    if (m_config.replay_rate > 0) {
+        const auto now { std::chrono::steady_clock::now() };
+        const auto rate { static_cast<double>(m_config.replay_rate) };
+        m_replay_tokens = std::min(rate, m_replay_tokens + (rate * std::chrono::duration<double> { now - m_last_replay }.count()));
+        m_last_replay = now;
+        budget = static_cast<std::size_t>(m_replay_tokens);
+    }
+    const std::size_t replayed { m_spool->replay(
+        [this](std::string_view topic, std::string_view content, const spool::options_t& options) {
+            const std::string terminated { topic };
+            return mosquitto_publish(m_mqtt, nullptr, terminated.c_str(), static_cast<int>(content.size()), static_cast<const void*>(content.data()), options.qos, options.retain) == MOSQ_ERR_SUCCESS;
+        },
+        budget) };
+    m_replay_tokens -= static_cast<double>(replayed);
+    if (m_spool->empty()) {
+        log::info("mqtt") << "Spooled messages sent.";
+    }
+}
+
 void mqtt::unsubscribe(const std::string& topic)
 {
+    m_subscription_trie.erase(subscription_filter(topic), topic);
     if (!check_connection()) {
         return;
     }
     log::info("mqtt") << "Unsubscribing from " << topic;
     mosquitto_unsubscribe(m_mqtt, nullptr, topic.c_str());
+    wake();
 }
 
 auto mqtt::publish(const std::string& topic) -> publisher&
+{
+    return publish(topic, publish_options_t {});
+}
+
+auto mqtt::publish(const std::string& topic, publish_options_t options) -> publisher&
 {
     if (!check_connection()) {
         log::error("mqtt") << "Could not register publisher: Not connected.";
@@ -219,7 +494,7 @@ auto mqtt::publish(const std::string& topic) -> publisher&
     if (m_publishers.find(topic) != m_publishers.end()) {
         return { *m_publishers[topic] };
     }
-    m_publishers[topic] = std::make_unique<publisher>(this, topic);
+    m_publishers[topic] = std::make_unique<publisher>(this, topic, options);
     log::info("mqtt") << "Starting to publish on topic " << topic;
     return { *m_publishers[topic] };
 }
@@ -238,9 +513,10 @@ auto mqtt::check_connection() -> bool
     return true;
 }
 
-auto mqtt::p_subscribe(const std::string& topic) -> bool
+auto mqtt::p_subscribe(const std::string& topic, QoS qos) -> bool
 {
-    auto result { mosquitto_subscribe(m_mqtt, nullptr, topic.c_str(), 1) };
+    auto result { mosquitto_subscribe(m_mqtt, nullptr, topic.c_str(), static_cast<int>(qos)) };
+    wake();
     if (result != MOSQ_ERR_SUCCESS) {
         switch (result) {
         case MOSQ_ERR_INVAL:
@@ -265,7 +541,7 @@ auto mqtt::p_subscribe(const std::string& topic) -> bool
     return true;
 }
 
-auto mqtt::subscribe(const std::string& topic) -> subscriber&
+auto mqtt::subscribe(const std::string& topic, QoS qos) -> subscriber&
 {
     if (!check_connection()) {
         log::error("mqtt") << "Could not register subscriber: Not connected.";
@@ -277,52 +553,71 @@ auto mqtt::subscribe(const std::string& topic) -> subscriber&
         return { *m_subscribers[topic] };
     }
 
-    if (!p_subscribe(topic)) {
+    if (!p_subscribe(topic, qos)) {
         log::error("mqtt") << "Could not register subscriber.";
         throw error::mqtt_could_not_subscribe(topic, "undisclosed error");
     }
-    m_subscribers[topic] = std::make_unique<subscriber>(this, topic);
+    m_subscribers[topic] = std::make_unique<subscriber>(this, topic, qos);
+    // keyed on the full topic, so a plain and a shared subscription of the same filter do not replace each other
+    m_subscription_trie.insert(subscription_filter(topic), topic, m_subscribers[topic].get());
     return { *m_subscribers[topic] };
 }
 
 auto mqtt::connect() -> bool
 {
-    std::mutex mx;
-    std::unique_lock<std::mutex> lock { mx };
-
-    if (m_connect_condition.wait_for(lock, std::chrono::seconds { m_tries }) == std::cv_status::no_timeout) {
-        return false;
-    }
-
-    if (check_connection()) {
-        log::notice("mqtt") << "Already connected.";
-        return true;
-    }
-
-    log::info("mqtt") << "Trying to connect.";
-    m_tries++;
-    set_status(Status::Connecting);
-
-    if (m_tries > m_config.max_retries) {
-        set_status(Status::Error);
-        log::error("mqtt") << "Giving up trying to connect.";
-        return false;
-    }
-    if (mosquitto_username_pw_set(m_mqtt, m_config.login.username.c_str(), m_config.login.password.c_str()) != MOSQ_ERR_SUCCESS) {
-        log::warning("mqtt") << "Could not set username and password.";
-        return false;
-    }
-    auto result { mosquitto_connect(m_mqtt, m_config.host.c_str(), m_config.port, m_config.keepalive) };
-    if (result == MOSQ_ERR_SUCCESS) {
-        m_connect_promise = std::promise<bool> {};
-        m_connect_future = m_connect_promise.get_future();
-        if ((m_connect_future.wait_for(m_config.timeout) == std::future_status::ready) && m_connect_future.get()) {
+    while (!m_quit) {
+        if (m_status == Status::Connected) {
+            m_tries = 0;
             return true;
         }
-    } else {
-        log::warning("mqtt") << "Could not connect: " << strerror(result);
+        if (m_tries >= m_config.max_retries) {
+            set_status(Status::Error);
+            log::error("mqtt") << "Giving up trying to connect.";
+            return false;
+        }
+        if (m_status != Status::Invalid) {
+            const auto delay { backoff() };
+            log::info("mqtt") << "Trying to connect in " << delay.count() << "ms.";
+            // nothing else reconnects, so only a stop ends the delay early
+            if (service_until(std::chrono::steady_clock::now() + delay, [this] { return m_quit.load(); })) {
+                continue;
+            }
+        }
+        m_tries++;
+        {
+            std::scoped_lock<std::mutex> lock { m_status_mutex };
+            m_attempts++;
+        }
+        log::info("mqtt") << "Trying to connect.";
+        set_status(Status::Connecting);
+
+        if (mosquitto_username_pw_set(m_mqtt, m_config.login.username.c_str(), m_config.login.password.c_str()) != MOSQ_ERR_SUCCESS) {
+            log::warning("mqtt") << "Could not set username and password.";
+            return false;
+        }
+        const auto result { mosquitto_connect(m_mqtt, m_config.host.c_str(), m_config.port, m_config.keepalive) };
+        if (result != MOSQ_ERR_SUCCESS) {
+            log::warning("mqtt") << "Could not connect: " << mosquitto_strerror(result);
+            set_status(Status::Error);
+            continue;
+        }
+        // the answer of the broker arrives through the network loop
+        const bool answered { service_until(std::chrono::steady_clock::now() + m_config.timeout, [this] { return m_quit || (m_status != Status::Connecting); }) };
+        if (!answered) {
+            log::warning("mqtt") << "Connection timed out.";
+            set_status(Status::Error);
+        }
     }
-    return connect();
+    return false;
+}
+
+auto mqtt::backoff() -> std::chrono::milliseconds
+{
+    const auto& config { m_config.reconnect };
+    const double exponent { static_cast<double>(m_tries) };
+    const double delay { std::min(static_cast<double>(config.maximum.count()), static_cast<double>(config.initial.count()) * std::pow(config.multiplier, exponent)) };
+    std::uniform_real_distribution<double> distribution { 1.0 - std::clamp(config.jitter, 0.0, 1.0), 1.0 };
+    return std::chrono::milliseconds { static_cast<std::chrono::milliseconds::rep>(delay * distribution(m_random)) };
 }
 
 auto mqtt::disconnect() -> bool
@@ -332,6 +627,8 @@ auto mqtt::disconnect() -> bool
     }
     auto result { mosquitto_disconnect(m_mqtt) };
     if (result == MOSQ_ERR_SUCCESS) {
+        // the disconnect packet is only queued, mosquitto closes the socket once it was written
+        static_cast<void>(service_until(std::chrono::steady_clock::now() + m_config.timeout, [this] { return mosquitto_socket(m_mqtt) < 0; }));
         set_status(Status::Disconnected);
         log::info("mqtt") << "Disconnected.";
         return true;
@@ -342,17 +639,29 @@ auto mqtt::disconnect() -> bool
 
 void mqtt::set_status(Status status)
 {
-    m_status = status;
+    {
+        std::scoped_lock<std::mutex> lock { m_status_mutex };
+        const auto now { std::chrono::steady_clock::now() };
+        const Status previous { m_status.exchange(status) };
+        if ((previous == Status::Connected) && (status != Status::Connected)) {
+            m_disconnected_since = now;
+        } else if ((previous != Status::Connected) && (status == Status::Connected) && m_disconnected_since.has_value()) {
+            m_downtime += now - *m_disconnected_since;
+            m_disconnected_since.reset();
+            m_reconnects++;
+        }
+    }
+    m_status_condition.notify_all();
 }
 
 auto mqtt::publisher::publish(const std::string& content) -> bool
 {
-    return m_link->publish(m_topic, content);
+    return m_link->publish(m_topic, content, m_options);
 }
 
 auto mqtt::publisher::publish(const std::string& subtopic, const std::string& content) -> bool
 {
-    return m_link->publish(m_topic + '/' + subtopic, content);
+    return m_link->publish(m_topic + '/' + subtopic, content, m_options);
 }
 
 auto mqtt::publisher::publish(const std::vector<std::string>& content) -> bool
@@ -361,7 +670,7 @@ auto mqtt::publisher::publish(const std::vector<std::string>& content) -> bool
     for (const auto& string : content) {
         stream << string << '\n';
     }
-    return m_link->publish(m_topic, stream.str());
+    return m_link->publish(m_topic, stream.str(), m_options);
 }
 
 auto mqtt::publisher::publish(const std::string& subtopic, const std::vector<std::string>& content) -> bool
@@ -370,7 +679,17 @@ auto mqtt::publisher::publish(const std::string& subtopic, const std::vector<std
     for (const auto& string : content) {
         stream << string << '\n';
     }
-    return m_link->publish(m_topic + '/' + subtopic, stream.str());
+    return m_link->publish(m_topic + '/' + subtopic, stream.str(), m_options);
+}
+
+auto mqtt::publisher::publish_async(std::string content) -> bool
+{
+    return m_link->enqueue(m_topic, std::move(content), m_options);
+}
+
+auto mqtt::publisher::publish_async(const std::string& subtopic, std::string content) -> bool
+{
+    return m_link->enqueue(m_topic + '/' + subtopic, std::move(content), m_options);
 }
 
 auto mqtt::publisher::get_publish_topic() const -> const std::string&
@@ -378,18 +697,52 @@ auto mqtt::publisher::get_publish_topic() const -> const std::string&
     return m_topic;
 }
 
+auto mqtt::publisher::get_options() const -> const publish_options_t&
+{
+    return m_options;
+}
+
 void mqtt::subscriber::emplace_callback(std::function<void(const message_t&)> callback)
 {
     m_callback.emplace_back(std::move(callback));
 }
 
-void mqtt::subscriber::push_message(const message_t& message)
+void mqtt::subscriber::emplace_view_callback(std::function<void(const message_view&)> callback)
 {
-    for (auto& callback : m_callback) {
+    m_view_callback.emplace_back(std::move(callback));
+}
+
+void mqtt::subscriber::emplace_payload_callback(std::function<void(const message_view&)> callback)
+{
+    m_payload_callback.emplace_back(std::move(callback));
+}
+
+void mqtt::subscriber::push_payload(const message_view& message)
+{
+    for (auto& callback : m_payload_callback) {
         callback(message);
     }
 }
 
+auto mqtt::subscriber::wants_lines() const -> bool
+{
+    return !m_callback.empty() || !m_view_callback.empty();
+}
+
+void mqtt::subscriber::push_message(const message_view& message)
+{
+    for (auto& callback : m_view_callback) {
+        callback(message);
+    }
+    if (m_callback.empty()) {
+        return;
+    }
+    const message_t copy { message.to_message() };
+    for (auto& callback : m_callback) {
+        callback(copy);
+    }
+}
+
 auto mqtt::subscriber::get_subscribe_topic() const -> const std::string&
 {
     return m_topic;
@@ -399,7 +752,7 @@ auto mqtt::client_id() const -> std::string
 {
     std::ostringstream out {};
 
-    out << std::hex << std::hash<std::string> {}(m_config.login.username + m_station_id);
+    out << std::hex << std::hash<std::string> {}(m_config.login.username + m_station_id) << m_config.client_id_suffix;
 
     return out.str();
 }
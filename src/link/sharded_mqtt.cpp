@@ -0,0 +1,138 @@
+#include "muonpi/link/sharded_mqtt.h"
+
+#include "muonpi/log.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace muonpi::link {
+
+sharded_mqtt::subscriber::subscriber(std::string topic, std::vector<mqtt::subscriber*> subscribers)
+    : m_topic { std::move(topic) }
+    , m_subscribers { std::move(subscribers) }
+{
+}
+
+void sharded_mqtt::subscriber::emplace_callback(const std::function<void(const mqtt::message_t&)>& callback)
+{
+    for (auto* sub : m_subscribers) {
+        sub->emplace_callback(callback);
+    }
+}
+
+void sharded_mqtt::subscriber::emplace_view_callback(const std::function<void(const mqtt::message_view&)>& callback)
+{
+    for (auto* sub : m_subscribers) {
+        sub->emplace_view_callback(callback);
+    }
+}
+
+void sharded_mqtt::subscriber::emplace_payload_callback(const std::function<void(const mqtt::message_view&)>& callback)
+{
+    for (auto* sub : m_subscribers) {
+        sub->emplace_payload_callback(callback);
+    }
+}
+
+auto sharded_mqtt::subscriber::get_subscribe_topic() const -> const std::string&
+{
+    return m_topic;
+}
+
+sharded_mqtt::sharded_mqtt(configuration config, const std::string& station_id, const std::string& name)
+    : m_config { std::move(config) }
+{
+    m_config.shards = std::max<std::size_t>(m_config.shards, 1);
+    if (m_config.share_group.empty()) {
+        m_config.share_group = station_id;
+    }
+    m_links.reserve(m_config.shards);
+    for (std::size_t i { 0 }; i < m_config.shards; i++) {
+        mqtt::configuration link { m_config.link };
+        link.client_id_suffix = '-' + std::to_string(i);
+        if (!link.offline_spool.directory.empty()) {
+            // every connection needs its own spool
+            link.offline_spool.directory += '/' + std::to_string(i);
+        }
+        m_links.emplace_back(std::make_unique<mqtt>(std::move(link), station_id, name));
+    }
+    log::info("mqtt") << "Opened " << m_config.shards << " connections.";
+}
+
+sharded_mqtt::~sharded_mqtt()
+{
+    // stopping all connections first lets them shut down in parallel
+    stop();
+    static_cast<void>(wait());
+}
+
+auto sharded_mqtt::publish(const std::string& topic) -> mqtt::publisher&
+{
+    return shard(topic).publish(topic);
+}
+
+auto sharded_mqtt::publish(const std::string& topic, mqtt::publish_options_t options) -> mqtt::publisher&
+{
+    return shard(topic).publish(topic, options);
+}
+
+auto sharded_mqtt::subscribe(const std::string& topic, mqtt::QoS qos) -> subscriber&
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    auto it { m_subscribers.find(topic) };
+    if (it != m_subscribers.end()) {
+        return *it->second;
+    }
+    // with a single connection there is nobody to share with
+    const std::string filter { (m_links.size() == 1) ? topic : ("$share/" + m_config.share_group + '/' + topic) };
+    std::vector<mqtt::subscriber*> subscribers {};
+    subscribers.reserve(m_links.size());
+    for (auto& link : m_links) {
+        subscribers.emplace_back(&link->subscribe(filter, qos));
+    }
+    it = m_subscribers.emplace(topic, std::make_unique<subscriber>(topic, std::move(subscribers))).first;
+    return *it->second;
+}
+
+auto sharded_mqtt::wait_for(mqtt::Status status, std::chrono::milliseconds duration) -> bool
+{
+    const auto deadline { std::chrono::steady_clock::now() + duration };
+    for (auto& link : m_links) {
+        const auto remaining { std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()) };
+        if (!link->wait_for(status, std::max(remaining, std::chrono::milliseconds { 0 }))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void sharded_mqtt::stop(int exit_code)
+{
+    for (auto& link : m_links) {
+        link->stop(exit_code);
+    }
+}
+
+auto sharded_mqtt::wait() -> int
+{
+    int result { 0 };
+    for (auto& link : m_links) {
+        const int code { link->wait() };
+        if (result == 0) {
+            result = code;
+        }
+    }
+    return result;
+}
+
+auto sharded_mqtt::shard(const std::string& topic) -> mqtt&
+{
+    return *m_links[std::hash<std::string> {}(topic) % m_links.size()];
+}
+
+auto sharded_mqtt::size() const -> std::size_t
+{
+    return m_links.size();
+}
+
+} // namespace muonpi::link
@@ -0,0 +1,363 @@
+#include "muonpi/link/spool.h"
+
+#include "muonpi/log.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace muonpi::link {
+
+namespace {
+    constexpr std::uint32_t s_magic { 0x4d50534c }; // "MPSL"
+    // version 2 added the delivery options to the records
+    constexpr std::uint32_t s_version { 2 };
+    constexpr std::size_t s_header_bytes { 64 };
+    /**
+     * @brief s_record_header Every record starts with the topic length and content length as 32 bit values,
+     * followed by one byte each for the QoS and the retain flag and two reserved bytes
+     */
+    constexpr std::size_t s_record_header { 3 * sizeof(std::uint32_t) };
+    constexpr std::size_t s_options_offset { 2 * sizeof(std::uint32_t) };
+    constexpr std::uint8_t s_max_qos { 2 };
+    constexpr std::string_view s_extension { ".spool" };
+    constexpr std::string_view s_rejected_extension { ".rejected" };
+}
+
+struct spool::header_t {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t write_offset;
+    std::uint64_t read_offset;
+    std::uint64_t records;
+    std::uint64_t read_records;
+};
+
+spool::segment::segment(const std::string& path, std::size_t bytes, bool create)
+{
+    m_fd = ::open(path.c_str(), O_RDWR | (create ? (O_CREAT | O_EXCL) : 0), S_IRUSR | S_IWUSR | S_IRGRP);
+    if (m_fd < 0) {
+        throw std::runtime_error("Could not open spool segment '" + path + "': " + std::strerror(errno));
+    }
+    if (create) {
+        if (::ftruncate(m_fd, static_cast<off_t>(bytes)) != 0) {
+            ::close(m_fd);
+            throw std::runtime_error("Could not allocate spool segment '" + path + "': " + std::strerror(errno));
+        }
+    } else {
+        struct stat info { };
+        ::fstat(m_fd, &info);
+        bytes = static_cast<std::size_t>(info.st_size);
+    }
+    if (bytes <= s_header_bytes) {
+        ::close(m_fd);
+        throw std::runtime_error("Spool segment '" + path + "' is too small.");
+    }
+    void* memory { ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0) };
+    if (memory == MAP_FAILED) {
+        ::close(m_fd);
+        throw std::runtime_error("Could not map spool segment '" + path + "': " + std::strerror(errno));
+    }
+    m_memory = static_cast<char*>(memory);
+    m_bytes = bytes;
+    if (create) {
+        header() = header_t { s_magic, s_version, 0, 0, 0, 0 };
+    } else if ((header().magic != s_magic) || (header().version != s_version)) {
+        ::munmap(m_memory, m_bytes);
+        ::close(m_fd);
+        throw std::runtime_error("'" + path + "' is not a spool segment.");
+    }
+}
+
+spool::segment::~segment()
+{
+    ::munmap(m_memory, m_bytes);
+    ::close(m_fd);
+}
+
+auto spool::segment::header() -> header_t&
+{
+    static_assert(sizeof(header_t) <= s_header_bytes);
+    return *reinterpret_cast<header_t*>(m_memory);
+}
+
+auto spool::segment::data() -> char*
+{
+    return m_memory + s_header_bytes;
+}
+
+auto spool::segment::capacity() const -> std::size_t
+{
+    return m_bytes - s_header_bytes;
+}
+
+void spool::segment::sync()
+{
+    ::msync(m_memory, m_bytes, MS_ASYNC);
+}
+
+spool::spool(configuration config)
+    : m_config { std::move(config) }
+{
+    m_config.segment_bytes = std::max(m_config.segment_bytes, s_header_bytes + s_record_header + 1);
+    m_config.max_segments = std::max<std::size_t>(m_config.max_segments, 1);
+
+    std::filesystem::create_directories(m_config.directory);
+    for (const auto& entry : std::filesystem::directory_iterator { m_config.directory }) {
+        const auto& file { entry.path() };
+        if (!entry.is_regular_file() || (file.extension() != s_extension)) {
+            continue;
+        }
+        try {
+            m_segments.emplace_back(std::stoull(file.stem().string()));
+        } catch (...) {
+            log::warning("spool") << "Ignoring unexpected file '" << file.string() << "'.";
+        }
+    }
+    std::sort(m_segments.begin(), m_segments.end());
+
+    for (auto it { m_segments.begin() }; it != m_segments.end();) {
+        try {
+            segment existing { path(*it), 0, false };
+            m_size += existing.header().records - existing.header().read_records;
+            it++;
+        } catch (std::exception& e) {
+            // moved aside instead of deleted, so an older version can still replay it
+            log::warning("spool") << e.what() << " Moving it aside.";
+            std::error_code ec {};
+            std::filesystem::rename(path(*it), path(*it) + std::string { s_rejected_extension }, ec);
+            it = m_segments.erase(it);
+        }
+    }
+    if (!m_segments.empty()) {
+        m_write = std::make_unique<segment>(path(m_segments.back()), 0, false);
+        log::info("spool") << "Resuming spool with " << m_size << " messages in " << m_segments.size() << " segments.";
+    }
+}
+
+spool::~spool()
+{
+    sync();
+}
+
+auto spool::path(std::uint64_t sequence) const -> std::string
+{
+    constexpr int digits { 20 };
+    std::ostringstream stream {};
+    stream << m_config.directory << '/' << std::setw(digits) << std::setfill('0') << sequence << s_extension;
+    return stream.str();
+}
+
+auto spool::append(std::string_view topic, std::string_view content) -> bool
+{
+    return append(topic, content, options_t {});
+}
+
+auto spool::append(std::string_view topic, std::string_view content, options_t options) -> bool
+{
+    const std::size_t bytes { s_record_header + topic.size() + content.size() };
+
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    if (bytes > (m_config.segment_bytes - s_header_bytes)) {
+        log::warning("spool") << "Message of " << bytes << " bytes does not fit into a segment.";
+        m_dropped++;
+        return false;
+    }
+    if ((m_write == nullptr) || ((m_write->header().write_offset + bytes) > m_write->capacity())) {
+        if (!open_write()) {
+            m_dropped++;
+            return false;
+        }
+    }
+
+    auto& header { m_write->header() };
+    char* position { m_write->data() + header.write_offset };
+    const auto topic_length { static_cast<std::uint32_t>(topic.size()) };
+    const auto content_length { static_cast<std::uint32_t>(content.size()) };
+    std::memcpy(position, &topic_length, sizeof(topic_length));
+    std::memcpy(position + sizeof(topic_length), &content_length, sizeof(content_length));
+    const std::array<std::uint8_t, sizeof(std::uint32_t)> stored { std::min(options.qos, s_max_qos), static_cast<std::uint8_t>(options.retain ? 1 : 0), 0, 0 };
+    std::memcpy(position + s_options_offset, stored.data(), stored.size());
+    std::memcpy(position + s_record_header, topic.data(), topic.size());
+    std::memcpy(position + s_record_header + topic.size(), content.data(), content.size());
+    // the record only becomes visible once the offset covers it
+    header.write_offset += bytes;
+    header.records++;
+    m_size++;
+    return true;
+}
+
+auto spool::open_write() -> bool
+{
+    if (m_segments.size() >= m_config.max_segments) {
+        if (!m_config.drop_oldest) {
+            return false;
+        }
+        remove_front();
+    }
+    const std::uint64_t sequence { m_segments.empty() ? 0 : (m_segments.back() + 1) };
+    m_write.reset();
+    try {
+        m_write = std::make_unique<segment>(path(sequence), m_config.segment_bytes, true);
+    } catch (std::exception& e) {
+        log::error("spool") << e.what();
+        return false;
+    }
+    m_segments.emplace_back(sequence);
+    return true;
+}
+
+void spool::remove_front()
+{
+    const std::uint64_t sequence { m_segments.front() };
+    std::size_t remaining { 0 };
+    if (m_read != nullptr) {
+        remaining = m_read->header().records - m_read->header().read_records;
+        m_read.reset();
+    } else {
+        segment oldest { path(sequence), 0, false };
+        remaining = oldest.header().records - oldest.header().read_records;
+    }
+    if (m_segments.size() == 1) {
+        m_write.reset();
+    }
+    std::filesystem::remove(path(sequence));
+    m_segments.pop_front();
+    m_size -= remaining;
+    m_dropped += remaining;
+    if (remaining > 0) {
+        log::warning("spool") << "Spool full, discarded " << remaining << " messages.";
+    }
+}
+
+auto spool::reader() -> segment*
+{
+    if (m_segments.empty()) {
+        return nullptr;
+    }
+    if (m_read == nullptr) {
+        m_read = std::make_unique<segment>(path(m_segments.front()), 0, false);
+    }
+    return m_read.get();
+}
+
+auto spool::replay(const std::function<bool(std::string_view topic, std::string_view content, const options_t& options)>& function, std::size_t max_messages) -> std::size_t
+{
+    std::size_t replayed { 0 };
+    std::string topic {};
+    std::string content {};
+    options_t options {};
+    while (replayed < max_messages) {
+        std::uint64_t sequence {};
+        std::uint64_t offset {};
+        {
+            std::scoped_lock<std::mutex> lock { m_mutex };
+            if (!peek(topic, content, options, sequence, offset)) {
+                break;
+            }
+        }
+        // appending goes on while the message is sent
+        if (!function(topic, content, options)) {
+            break;
+        }
+        std::scoped_lock<std::mutex> lock { m_mutex };
+        if ((m_read == nullptr) || m_segments.empty() || (m_segments.front() != sequence) || (m_read->header().read_offset != offset)) {
+            // the segment was discarded meanwhile, because the spool ran full
+            continue;
+        }
+        auto& header { m_read->header() };
+        header.read_offset += s_record_header + topic.size() + content.size();
+        header.read_records++;
+        m_size--;
+        replayed++;
+    }
+    return replayed;
+}
+
+auto spool::peek(std::string& topic, std::string& content, options_t& options, std::uint64_t& sequence, std::uint64_t& offset) -> bool
+{
+    for (;;) {
+        segment* current { reader() };
+        if (current == nullptr) {
+            return false;
+        }
+        auto& header { current->header() };
+        if (header.read_offset >= header.write_offset) {
+            if (m_segments.size() == 1) {
+                // caught up with the writer
+                return false;
+            }
+            m_read.reset();
+            std::filesystem::remove(path(m_segments.front()));
+            m_segments.pop_front();
+            continue;
+        }
+        const std::uint64_t end { header.write_offset };
+        bool valid { (end <= current->capacity()) && ((header.read_offset + s_record_header) <= end) };
+        std::uint32_t topic_length {};
+        std::uint32_t content_length {};
+        std::array<std::uint8_t, sizeof(std::uint32_t)> stored {};
+        if (valid) {
+            const char* position { current->data() + header.read_offset };
+            std::memcpy(&topic_length, position, sizeof(topic_length));
+            std::memcpy(&content_length, position + sizeof(topic_length), sizeof(content_length));
+            std::memcpy(stored.data(), position + s_options_offset, stored.size());
+            valid = ((header.read_offset + s_record_header + topic_length + content_length) <= end) && (stored[0] <= s_max_qos) && (stored[1] <= 1);
+        }
+        if (!valid) {
+            const std::size_t remaining { std::min<std::size_t>(header.records - header.read_records, m_size) };
+            log::warning("spool") << "Segment " << m_segments.front() << " is corrupted at offset " << header.read_offset << ", discarding its remaining " << remaining << " messages.";
+            header.read_offset = header.write_offset;
+            header.read_records = header.records;
+            m_size -= remaining;
+            m_dropped += remaining;
+            continue;
+        }
+        const char* position { current->data() + header.read_offset + s_record_header };
+        topic.assign(position, topic_length);
+        content.assign(position + topic_length, content_length);
+        options = options_t { stored[0], stored[1] == 1 };
+        sequence = m_segments.front();
+        offset = header.read_offset;
+        return true;
+    }
+}
+
+auto spool::size() const -> std::size_t
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    return m_size;
+}
+
+auto spool::empty() const -> bool
+{
+    return size() == 0;
+}
+
+auto spool::dropped() const -> std::size_t
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    return m_dropped;
+}
+
+void spool::sync()
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    if (m_write != nullptr) {
+        m_write->sync();
+    }
+    if (m_read != nullptr) {
+        m_read->sync();
+    }
+}
+
+} // namespace muonpi::link
@@ -0,0 +1,208 @@
+#include "muonpi/metrics.h"
+
+#include <sstream>
+
+namespace muonpi::metrics {
+
+namespace detail {
+    auto stripe() -> std::size_t
+    {
+        static std::atomic<std::size_t> next { 0 };
+        thread_local const std::size_t index { next++ % s_stripes };
+        return index;
+    }
+}
+
+namespace {
+    [[nodiscard]] auto to_microseconds(double ns) -> double
+    {
+        constexpr double ns_per_us { 1000.0 };
+        return ns / ns_per_us;
+    }
+
+    void write(std::ostream& stream, const latency::summary_t& summary)
+    {
+        stream << "{\"count\":" << summary.count
+               << ",\"mean_us\":" << summary.mean
+               << ",\"p50_us\":" << summary.p50
+               << ",\"p90_us\":" << summary.p90
+               << ",\"p99_us\":" << summary.p99
+               << ",\"max_us\":" << summary.max << '}';
+    }
+
+    void write_escaped(std::ostream& stream, const std::string& text)
+    {
+        stream << '"';
+        for (const char c : text) {
+            if ((c == '"') || (c == '\\')) {
+                stream << '\\';
+            }
+            stream << c;
+        }
+        stream << '"';
+    }
+}
+
+auto counter::value() const -> std::uint64_t
+{
+    std::uint64_t sum { 0 };
+    for (const auto& current : m_stripes) {
+        sum += current.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+auto high_water::value() const -> std::uint64_t
+{
+    return m_value.load(std::memory_order_relaxed);
+}
+
+auto latency::summary() const -> summary_t
+{
+    std::array<std::uint64_t, s_buckets> buckets {};
+    std::uint64_t sum { 0 };
+    summary_t result {};
+    for (const auto& current : m_stripes) {
+        for (std::size_t i { 0 }; i < s_buckets; i++) {
+            const auto n { current.buckets[i].load(std::memory_order_relaxed) };
+            buckets[i] += n;
+            result.count += n;
+        }
+        sum += current.sum.load(std::memory_order_relaxed);
+    }
+    if (result.count == 0) {
+        return result;
+    }
+    result.mean = to_microseconds(static_cast<double>(sum) / static_cast<double>(result.count));
+
+    const auto upper { [](std::size_t bucket) { return to_microseconds(static_cast<double>(bucket + 1 < s_buckets ? (std::uint64_t { 1 } << (bucket + 1)) : ~std::uint64_t { 0 })); } };
+    const auto rank { [&result](double quantile) { return static_cast<std::uint64_t>(quantile * static_cast<double>(result.count - 1)) + 1; } };
+    constexpr double q50 { 0.5 };
+    constexpr double q90 { 0.9 };
+    constexpr double q99 { 0.99 };
+
+    std::uint64_t seen { 0 };
+    for (std::size_t i { 0 }; i < s_buckets; i++) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        const std::uint64_t before { seen };
+        seen += buckets[i];
+        if ((before < rank(q50)) && (seen >= rank(q50))) {
+            result.p50 = upper(i);
+        }
+        if ((before < rank(q90)) && (seen >= rank(q90))) {
+            result.p90 = upper(i);
+        }
+        if ((before < rank(q99)) && (seen >= rank(q99))) {
+            result.p99 = upper(i);
+        }
+        result.max = upper(i);
+    }
+    return result;
+}
+
+stage::stage(std::string name, std::function<std::uint64_t()> pending, std::function<std::uint64_t()> dropped)
+    : m_name { std::move(name) }
+    , m_pending { std::move(pending) }
+    , m_dropped { std::move(dropped) }
+{
+    registry::instance().add(*this);
+}
+
+stage::~stage()
+{
+    registry::instance().remove(*this);
+}
+
+auto stage::name() const -> const std::string&
+{
+    return m_name;
+}
+
+auto stage::snapshot() const -> snapshot_t
+{
+    snapshot_t result {};
+    result.name = m_name;
+    result.taken = std::chrono::steady_clock::now();
+    result.items_in = items_in.value();
+    result.items_out = items_out.value();
+    result.high_water = queue_depth.value();
+    result.queue_time = queue_time.summary();
+    result.process_time = process_time.summary();
+    if (m_pending) {
+        result.pending = m_pending();
+    }
+    if (m_dropped) {
+        result.dropped = m_dropped();
+    }
+    return result;
+}
+
+auto stage::rate(const snapshot_t& previous, const snapshot_t& current) -> double
+{
+    const std::chrono::duration<double> elapsed { current.taken - previous.taken };
+    if ((elapsed.count() <= 0.0) || (current.items_out < previous.items_out)) {
+        return 0.0;
+    }
+    return static_cast<double>(current.items_out - previous.items_out) / elapsed.count();
+}
+
+auto registry::instance() -> registry&
+{
+    static registry s_registry {};
+    return s_registry;
+}
+
+void registry::add(stage& entry)
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    m_stages.emplace_back(&entry);
+}
+
+void registry::remove(stage& entry)
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    m_stages.erase(std::remove(m_stages.begin(), m_stages.end(), &entry), m_stages.end());
+}
+
+auto registry::snapshot() -> std::vector<stage::snapshot_t>
+{
+    std::scoped_lock<std::mutex> lock { m_mutex };
+    std::vector<stage::snapshot_t> result {};
+    result.reserve(m_stages.size());
+    for (auto* entry : m_stages) {
+        result.emplace_back(entry->snapshot());
+    }
+    return result;
+}
+
+auto registry::to_json() -> std::string
+{
+    std::ostringstream stream {};
+    stream << '[';
+    bool first { true };
+    for (const auto& entry : snapshot()) {
+        if (!first) {
+            stream << ',';
+        }
+        first = false;
+        stream << "{\"name\":";
+        write_escaped(stream, entry.name);
+        stream << ",\"items_in\":" << entry.items_in
+               << ",\"items_out\":" << entry.items_out
+               << ",\"dropped\":" << entry.dropped
+               << ",\"pending\":" << entry.pending
+               << ",\"high_water\":" << entry.high_water
+               << ",\"timestamp\":" << std::chrono::duration<double> { entry.taken.time_since_epoch() }.count()
+               << ",\"queue_time\":";
+        write(stream, entry.queue_time);
+        stream << ",\"process_time\":";
+        write(stream, entry.process_time);
+        stream << '}';
+    }
+    stream << ']';
+    return stream.str();
+}
+
+} // namespace muonpi::metrics
@@ -0,0 +1,41 @@
+#include "muonpi/notifier.h"
+
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace muonpi {
+
+void notifier::notify()
+{
+    if (m_state.exchange(Notified) == Sleeping) {
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&m_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+}
+
+auto notifier::wait_for(std::chrono::microseconds timeout) -> bool
+{
+    if (m_state.exchange(Idle) == Notified) {
+        return true;
+    }
+    if (timeout.count() <= 0) {
+        return false;
+    }
+    std::uint32_t expected { Idle };
+    if (!m_state.compare_exchange_strong(expected, Sleeping)) {
+        m_state = Idle;
+        return true;
+    }
+
+    const auto seconds { std::chrono::duration_cast<std::chrono::seconds>(timeout) };
+    timespec time {};
+    time.tv_sec = static_cast<time_t>(seconds.count());
+    time.tv_nsec = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds).count());
+
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&m_state), FUTEX_WAIT_PRIVATE, Sleeping, &time, nullptr, 0);
+
+    return m_state.exchange(Idle) == Notified;
+}
+
+} // namespace muonpi
@@ -0,0 +1,316 @@
+#include "muonpi/placement.h"
+
+#include "muonpi/log.h"
+
+#include <cerrno>
+#include <climits>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace muonpi {
+
+namespace {
+    constexpr std::size_t s_word_bits { sizeof(unsigned long) * CHAR_BIT };
+    constexpr std::size_t s_node_words { 16 };
+
+    [[nodiscard]] auto to_native(thread_placement::Policy policy) -> int
+    {
+        switch (policy) {
+        case thread_placement::Policy::Other:
+            return SCHED_OTHER;
+        case thread_placement::Policy::Fifo:
+            return SCHED_FIFO;
+        case thread_placement::Policy::RoundRobin:
+            return SCHED_RR;
+        case thread_placement::Policy::Batch:
+            return SCHED_BATCH;
+        case thread_placement::Policy::Idle:
+            return SCHED_IDLE;
+        }
+        return SCHED_OTHER;
+    }
+
+    [[nodiscard]] auto policy_name(thread_placement::Policy policy) -> std::string
+    {
+        switch (policy) {
+        case thread_placement::Policy::Other:
+            return "other";
+        case thread_placement::Policy::Fifo:
+            return "fifo";
+        case thread_placement::Policy::RoundRobin:
+            return "rr";
+        case thread_placement::Policy::Batch:
+            return "batch";
+        case thread_placement::Policy::Idle:
+            return "idle";
+        }
+        return {};
+    }
+
+    [[nodiscard]] auto realtime(std::optional<thread_placement::Policy> policy) -> bool
+    {
+        return policy.has_value() && ((*policy == thread_placement::Policy::Fifo) || (*policy == thread_placement::Policy::RoundRobin));
+    }
+
+    [[nodiscard]] auto parse_int(const std::string& key, const std::string& value) -> int
+    {
+        try {
+            std::size_t end {};
+            const int result { std::stoi(value, &end) };
+            if (end == value.size()) {
+                return result;
+            }
+        } catch (...) {
+        }
+        log::error("placement") << "Invalid value '" << value << "' for '" << key << "'.";
+        throw std::runtime_error("Invalid value '" + value + "' for placement option '" + key + "'.");
+    }
+
+    [[nodiscard]] auto parse_cpus(const std::string& value) -> std::vector<int>
+    {
+        std::vector<int> cpus {};
+        std::istringstream stream { value };
+        std::string range {};
+        while (std::getline(stream, range, ',')) {
+            const auto dash { range.find('-') };
+            if (dash == std::string::npos) {
+                cpus.emplace_back(parse_int("cpus", range));
+                continue;
+            }
+            const int first { parse_int("cpus", range.substr(0, dash)) };
+            const int last { parse_int("cpus", range.substr(dash + 1)) };
+            for (int cpu { first }; cpu <= last; cpu++) {
+                cpus.emplace_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    [[nodiscard]] auto thread_id() -> id_t
+    {
+        return static_cast<id_t>(syscall(SYS_gettid));
+    }
+
+    auto set_mempolicy(int mode, const unsigned long* mask, std::size_t bits) -> bool
+    {
+        return syscall(SYS_set_mempolicy, mode, mask, bits) == 0;
+    }
+
+    auto get_mempolicy(int* mode, unsigned long* mask, std::size_t bits) -> bool
+    {
+        return syscall(SYS_get_mempolicy, mode, mask, bits, nullptr, 0) == 0;
+    }
+}
+
+auto thread_placement::from_string(const std::string& config) -> thread_placement
+{
+    thread_placement placement {};
+    std::string normalised { config };
+    for (auto& c : normalised) {
+        if (c == ';') {
+            c = ' ';
+        }
+    }
+    std::istringstream stream { normalised };
+    std::string token {};
+    while (stream >> token) {
+        const auto equals { token.find('=') };
+        if (equals == std::string::npos) {
+            log::error("placement") << "Expected key=value, got '" << token << "'.";
+            throw std::runtime_error("Invalid placement option '" + token + "'.");
+        }
+        const std::string key { token.substr(0, equals) };
+        const std::string value { token.substr(equals + 1) };
+        if (key == "cpus") {
+            placement.cpus = parse_cpus(value);
+        } else if (key == "policy") {
+            if (value == "other") {
+                placement.policy = Policy::Other;
+            } else if (value == "fifo") {
+                placement.policy = Policy::Fifo;
+            } else if (value == "rr") {
+                placement.policy = Policy::RoundRobin;
+            } else if (value == "batch") {
+                placement.policy = Policy::Batch;
+            } else if (value == "idle") {
+                placement.policy = Policy::Idle;
+            } else {
+                log::error("placement") << "Unknown scheduling policy '" << value << "'.";
+                throw std::runtime_error("Unknown scheduling policy '" + value + "'.");
+            }
+        } else if (key == "priority") {
+            placement.priority = parse_int(key, value);
+        } else if (key == "nice") {
+            placement.nice = parse_int(key, value);
+        } else if (key == "numa") {
+            placement.numa_node = parse_int(key, value);
+        } else {
+            log::error("placement") << "Unknown placement option '" << key << "'.";
+            throw std::runtime_error("Unknown placement option '" + key + "'.");
+        }
+    }
+    return placement;
+}
+
+auto thread_placement::current() -> thread_placement
+{
+    thread_placement placement {};
+
+    cpu_set_t set {};
+    CPU_ZERO(&set);
+    if ((sched_getaffinity(0, sizeof(set), &set) == 0) && (CPU_COUNT(&set) < sysconf(_SC_NPROCESSORS_ONLN))) {
+        for (int cpu { 0 }; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                placement.cpus.emplace_back(cpu);
+            }
+        }
+    }
+
+    int native {};
+    sched_param param {};
+    if (pthread_getschedparam(pthread_self(), &native, &param) == 0) {
+        for (const auto policy : { Policy::Other, Policy::Fifo, Policy::RoundRobin, Policy::Batch, Policy::Idle }) {
+            if (to_native(policy) == (native & ~SCHED_RESET_ON_FORK)) {
+                placement.policy = policy;
+            }
+        }
+        placement.priority = param.sched_priority;
+    }
+
+    if (!realtime(placement.policy)) {
+        errno = 0;
+        const int nice { getpriority(PRIO_PROCESS, thread_id()) };
+        if (errno == 0) {
+            placement.nice = nice;
+        }
+    }
+
+    int mode {};
+    std::array<unsigned long, s_node_words> mask {};
+    if (get_mempolicy(&mode, mask.data(), mask.size() * s_word_bits) && ((mode == MPOL_PREFERRED) || (mode == MPOL_BIND))) {
+        for (std::size_t node { 0 }; node < (mask.size() * s_word_bits); node++) {
+            if ((mask[node / s_word_bits] & (1UL << (node % s_word_bits))) != 0) {
+                placement.numa_node = static_cast<int>(node);
+                break;
+            }
+        }
+    }
+
+    return placement;
+}
+
+auto thread_placement::to_string() const -> std::string
+{
+    std::ostringstream stream {};
+    if (!cpus.empty()) {
+        stream << "cpus=";
+        for (std::size_t i { 0 }; i < cpus.size(); i++) {
+            stream << ((i > 0) ? "," : "") << cpus[i];
+        }
+        stream << ' ';
+    }
+    if (policy.has_value()) {
+        stream << "policy=" << policy_name(*policy) << ' ';
+    }
+    if (realtime(policy)) {
+        stream << "priority=" << priority << ' ';
+    }
+    if (nice.has_value()) {
+        stream << "nice=" << *nice << ' ';
+    }
+    if (numa_node >= 0) {
+        stream << "numa=" << numa_node << ' ';
+    }
+    std::string result { stream.str() };
+    if (!result.empty()) {
+        result.pop_back();
+    }
+    return result;
+}
+
+auto thread_placement::empty() const -> bool
+{
+    return cpus.empty() && !policy.has_value() && !nice.has_value() && (numa_node < 0);
+}
+
+auto thread_placement::apply() const -> bool
+{
+    bool success { true };
+
+    if (!cpus.empty()) {
+        cpu_set_t set {};
+        CPU_ZERO(&set);
+        for (const int cpu : cpus) {
+            if ((cpu >= 0) && (cpu < CPU_SETSIZE)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            log::warning("placement") << "Could not set the cpu affinity to '" << to_string() << "'.";
+            success = false;
+        }
+    }
+
+    if (policy.has_value()) {
+        sched_param param {};
+        param.sched_priority = realtime(policy) ? priority : 0;
+        if (pthread_setschedparam(pthread_self(), to_native(*policy), &param) != 0) {
+            log::warning("placement") << "Could not set the scheduling policy '" << policy_name(*policy) << "', missing privileges?";
+            success = false;
+        }
+    }
+
+    if (nice.has_value() && !realtime(policy)) {
+        if (setpriority(PRIO_PROCESS, thread_id(), *nice) != 0) {
+            log::warning("placement") << "Could not set the nice level to " << *nice << ", missing privileges?";
+            success = false;
+        }
+    }
+
+    if (numa_node >= 0) {
+        std::array<unsigned long, s_node_words> mask {};
+        const auto node { static_cast<std::size_t>(numa_node) };
+        if (node >= (mask.size() * s_word_bits)) {
+            log::warning("placement") << "NUMA node " << numa_node << " out of range.";
+            success = false;
+        } else {
+            mask[node / s_word_bits] |= 1UL << (node % s_word_bits);
+            if (!set_mempolicy(MPOL_PREFERRED, mask.data(), mask.size() * s_word_bits)) {
+                log::warning("placement") << "Could not prefer NUMA node " << numa_node << '.';
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+numa_scope::numa_scope(int node)
+{
+    if ((node < 0) || (static_cast<std::size_t>(node) >= (s_mask_words * s_word_bits))) {
+        return;
+    }
+    if (!get_mempolicy(&m_mode, m_mask.data(), s_mask_words * s_word_bits)) {
+        return;
+    }
+    std::array<unsigned long, s_mask_words> mask {};
+    const auto index { static_cast<std::size_t>(node) };
+    mask[index / s_word_bits] |= 1UL << (index % s_word_bits);
+    m_active = set_mempolicy(MPOL_PREFERRED, mask.data(), s_mask_words * s_word_bits);
+}
+
+numa_scope::~numa_scope()
+{
+    if (!m_active) {
+        return;
+    }
+    set_mempolicy(m_mode, (m_mode == MPOL_DEFAULT) ? nullptr : m_mask.data(), s_mask_words * s_word_bits);
+}
+
+} // namespace muonpi
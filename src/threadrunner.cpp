@@ -13,7 +13,12 @@ thread_runner::thread_runner(std::string name, bool use_custom_run)
 {
 }
 
-thread_runner::~thread_runner() = default;
+thread_runner::~thread_runner()
+{
+    detach_executor();
+    std::scoped_lock<std::mutex> lock { m_guard->mutex };
+    m_guard->runner = nullptr;
+}
 
 void thread_runner::stop(int exit_code)
 {
@@ -22,6 +27,7 @@ void thread_runner::stop(int exit_code)
     m_exit_code = exit_code;
     m_condition.notify_all();
     on_stop();
+    resume();
 }
 
 void thread_runner::join()
@@ -88,6 +94,14 @@ auto thread_runner::run() -> int
 
     try {
         log::debug("thread") << "Starting '" << m_name << '\'';
+        if (!m_placement.empty()) {
+            static_cast<void>(m_placement.apply());
+        }
+        {
+            const std::string effective { thread_placement::current().to_string() };
+            std::scoped_lock<std::mutex> lock { m_placement_mutex };
+            m_effective_placement = effective;
+        }
         int pre_result { pre_run() };
         if (pre_result != 0) {
             return pre_result;
@@ -170,6 +184,26 @@ auto thread_runner::state_string() -> std::string
     return {};
 }
 
+void thread_runner::set_placement(thread_placement placement)
+{
+    if (m_state > State::Initial) {
+        log::warning("thread") << "'" << m_name << "' already running, placement is applied on start only.";
+        return;
+    }
+    m_placement = std::move(placement);
+}
+
+auto thread_runner::placement() const -> thread_placement
+{
+    return m_placement;
+}
+
+auto thread_runner::placement_string() -> std::string
+{
+    std::scoped_lock<std::mutex> lock { m_placement_mutex };
+    return m_effective_placement;
+}
+
 void thread_runner::start()
 {
     if ((m_state > State::Initial) || (m_thread != nullptr)) {
@@ -179,6 +213,201 @@ void thread_runner::start()
     m_thread = std::make_unique<std::thread>(&thread_runner::exec, this);
 }
 
+void thread_runner::start(executor& exec, executor::Priority priority, int worker)
+{
+    if ((m_state > State::Initial) || (m_thread != nullptr) || (m_executor != nullptr)) {
+        log::info("thread") << "'" << m_name << "' already running, refusing to start.";
+        return;
+    }
+    if (m_use_custom_run) {
+        log::info("thread") << "'" << m_name << "' has a custom main loop, starting it on a dedicated thread.";
+        start();
+        return;
+    }
+    if (!m_placement.empty()) {
+        log::info("thread") << "'" << m_name << "' runs on an executor, ignoring its placement.";
+    }
+    m_executor = &exec;
+    m_priority = priority;
+    m_worker = worker;
+    m_guard->runner = this;
+    m_run_future = m_run_promise.get_future();
+    // the tasks of the runner get discarded if the executor is destroyed first, so wait() must not wait for them
+    m_attachment = m_executor->attach([this] {
+        m_attached = false;
+        m_schedule = Schedule::Finished;
+        log::warning("thread") << "'" << m_name << "' was abandoned by its executor.";
+        set_state(State::Error);
+        m_run_promise.set_value(-1);
+    });
+    m_attached = true;
+    m_timer = m_executor->create_timer(
+        [guard = std::weak_ptr<timer_guard> { m_guard }] {
+            auto locked { guard.lock() };
+            if (locked == nullptr) {
+                return;
+            }
+            std::scoped_lock<std::mutex> lock { locked->mutex };
+            if (locked->runner != nullptr) {
+                locked->runner->on_timer();
+            }
+        },
+        m_priority, m_worker);
+    m_executor->post([this] { cooperative_begin(); }, m_priority, m_worker);
+}
+
+void thread_runner::detach_executor()
+{
+    if (m_attached.exchange(false)) {
+        m_executor->destroy_timer(m_timer);
+        m_executor->detach(m_attachment);
+    }
+}
+
+auto thread_runner::cooperative() const -> bool
+{
+    return m_executor != nullptr;
+}
+
+void thread_runner::suspend(std::chrono::microseconds timeout)
+{
+    m_suspend_requested = true;
+    m_suspend_timeout = timeout;
+}
+
+void thread_runner::resume()
+{
+    if (m_executor == nullptr) {
+        return;
+    }
+    m_resume_pending = true;
+    Schedule expected { Schedule::Suspended };
+    if (m_schedule.compare_exchange_strong(expected, Schedule::Active)) {
+        m_resume_pending = false;
+        reschedule();
+    }
+}
+
+void thread_runner::reschedule()
+{
+    m_executor->post([this] { cooperative_step(); }, m_priority, m_worker);
+}
+
+void thread_runner::cooperative_begin()
+{
+    set_state(State::Initialising);
+    log::debug("thread") << "Starting '" << m_name << "' on executor";
+    int pre_result { -1 };
+    try {
+        pre_result = pre_run();
+    } catch (std::exception& e) {
+        log::error("thread") << "'" << m_name << "' Got an uncaught exception: " << e.what();
+    } catch (...) {
+        log::error("thread") << "'" << m_name << "' Got an uncaught exception.";
+    }
+    if (pre_result != 0) {
+        set_state(State::Error);
+        m_schedule = Schedule::Finished;
+        detach_executor();
+        m_run_promise.set_value(pre_result);
+        return;
+    }
+    set_state(State::Running);
+    cooperative_step();
+}
+
+void thread_runner::cooperative_step()
+{
+    if (!m_run) {
+        cooperative_end(0);
+        return;
+    }
+    int result { 0 };
+    try {
+        result = step();
+    } catch (std::exception& e) {
+        log::error("thread") << "'" << m_name << "' Got an uncaught exception: " << e.what();
+        cooperative_end(-1);
+        return;
+    } catch (...) {
+        log::error("thread") << "'" << m_name << "' Got an uncaught exception.";
+        cooperative_end(-1);
+        return;
+    }
+    if (result != 0) {
+        log::warning("thread") << "'" << m_name << "' Stopped.";
+        cooperative_end(result);
+        return;
+    }
+    if (!m_suspend_requested) {
+        reschedule();
+        return;
+    }
+    m_suspend_requested = false;
+
+    // once suspended, a resume may schedule the next step concurrently,
+    // so only local copies and atomics are used from here on.
+    const auto wake_at { std::chrono::steady_clock::now() + m_suspend_timeout };
+    m_wake_at = wake_at.time_since_epoch().count();
+    m_schedule = Schedule::Suspended;
+    if (m_resume_pending.exchange(false) || !m_run) {
+        resume();
+        return;
+    }
+    arm_timer(wake_at);
+}
+
+void thread_runner::on_timer()
+{
+    m_timer_deadline = std::chrono::steady_clock::time_point::max().time_since_epoch().count();
+    if (m_schedule != Schedule::Suspended) {
+        return;
+    }
+    // the timer may have been armed for an earlier suspension, which already ended
+    const std::chrono::steady_clock::time_point wake_at { std::chrono::steady_clock::duration { m_wake_at.load() } };
+    if (wake_at > std::chrono::steady_clock::now()) {
+        arm_timer(wake_at);
+        return;
+    }
+    Schedule expected { Schedule::Suspended };
+    if (m_schedule.compare_exchange_strong(expected, Schedule::Active)) {
+        reschedule();
+    }
+}
+
+void thread_runner::arm_timer(std::chrono::steady_clock::time_point deadline)
+{
+    const auto value { deadline.time_since_epoch().count() };
+    auto armed { m_timer_deadline.load() };
+    while (value < armed) {
+        if (m_timer_deadline.compare_exchange_weak(armed, value)) {
+            m_executor->arm_timer(m_timer, deadline);
+            return;
+        }
+    }
+}
+
+void thread_runner::cooperative_end(int result)
+{
+    set_state(State::Finalising);
+    log::debug("thread") << "Stopping '" << m_name << '\'';
+    if (result != 0) {
+        m_exit_code = result;
+    }
+    int value { -1 };
+    try {
+        value = post_run() + m_exit_code;
+    } catch (std::exception& e) {
+        log::error("thread") << "'" << m_name << "' Got an uncaught exception: " << e.what();
+    } catch (...) {
+        log::error("thread") << "'" << m_name << "' Got an uncaught exception.";
+    }
+    set_state((m_exit_code == 0) ? State::Stopped : State::Error);
+    m_schedule = Schedule::Finished;
+    detach_executor();
+    m_run_promise.set_value(value);
+}
+
 void thread_runner::start_synchronuos()
 {
     if (m_state > State::Initial) {